@@ -6,10 +6,16 @@ CC="${CXX:-cc}"
 PKGS="sdl2 glew freetype2"
 CFLAGS="-Wall -Wextra -std=c11 -pedantic -ggdb"
 LIBS=-lm
-SRC="src/main.c src/la.c src/editor.c src/file_browser.c src/free_glyph.c src/simple_renderer.c src/common.c src/lexer.c"
+SRC="src/main.c src/la.c src/editor.c src/file_browser.c src/free_glyph.c src/simple_renderer.c src/common.c src/lexer.c src/piece_table.c src/line_index.c src/line_index_parallel.c src/line_slot.c src/utf8.c"
 
 if [ `uname` = "Darwin" ]; then
     CFLAGS+=" -framework OpenGL"
 fi
 
+# The keywords hash table is regenerated, so a colliding keyword fails the build
+$CC $CFLAGS -o gen_keywords src/gen_keywords.c
+./gen_keywords > src/lexer_keywords.h.tmp
+mv src/lexer_keywords.h.tmp src/lexer_keywords.h
+
 $CC $CFLAGS `pkg-config --cflags $PKGS` -o ded $SRC $LIBS `pkg-config --libs $PKGS`
+$CC $CFLAGS -O3 `pkg-config --cflags $PKGS` -o bench src/bench.c src/line_index.c src/line_index_parallel.c src/lexer.c src/line_slot.c src/common.c $LIBS `pkg-config --libs $PKGS`
@@ -0,0 +1,50 @@
+#version 330 core
+
+#define SIMPLE_INSTANCE_GLYPH 0u
+#define SIMPLE_INSTANCE_RECT  1u
+
+uniform vec2 resolution;
+uniform float time;
+uniform float camera_scale;
+uniform vec2 camera_pos;
+uniform sampler2D glyph_metrics;
+
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 size;
+layout(location = 2) in vec4 color;
+layout(location = 3) in uint glyph;
+layout(location = 4) in uint shader;
+layout(location = 5) in uint kind;
+
+out vec4 out_color;
+out vec2 out_uv;
+flat out uint out_shader;
+
+vec2 camera_project(vec2 point)
+{
+    return 2.0 * (point - camera_pos) * camera_scale / resolution;
+}
+
+void main() {
+    // 2-3
+    // |\|
+    // 0-1
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+
+    vec2 p;
+    if (kind == SIMPLE_INSTANCE_RECT) {
+        p = position + corner*size;
+        out_uv = corner;
+    } else {
+        // (bitmap_left, bitmap_top, bitmap_width, bitmap_rows)
+        vec4 bitmap = texelFetch(glyph_metrics, ivec2(int(glyph), 0), 0);
+        // (u0, u1, v0, v1)
+        vec4 uv = texelFetch(glyph_metrics, ivec2(int(glyph), 1), 0);
+        p = position + bitmap.xy + corner*vec2(bitmap.z, -bitmap.w);
+        out_uv = vec2(mix(uv.x, uv.y, corner.x), mix(uv.z, uv.w, corner.y));
+    }
+
+    gl_Position = vec4(camera_project(p), 0, 1);
+    out_color = color;
+    out_shader = shader;
+}
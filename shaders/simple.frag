@@ -0,0 +1,40 @@
+#version 330 core
+
+// Must match the values of Simple_Shader
+#define SHADER_FOR_COLOR     0u
+#define SHADER_FOR_IMAGE     1u
+#define SHADER_FOR_TEXT      2u
+#define SHADER_FOR_EPICNESS  3u
+
+uniform float time;
+uniform vec2 resolution;
+uniform sampler2D image;
+
+in vec4 out_color;
+in vec2 out_uv;
+flat in uint out_shader;
+
+vec3 hsl2rgb(vec3 c) {
+    vec3 rgb = clamp(abs(mod(c.x*6.0+vec3(0.0,4.0,2.0),6.0)-3.0)-1.0, 0.0, 1.0);
+    return c.z + c.y * (rgb-0.5)*(1.0-abs(2.0*c.z-1.0));
+}
+
+void main() {
+    // NOTE: sampled outside of the branches, since the derivatives are undefined in non-uniform control flow
+    vec4 tc = texture(image, out_uv);
+    float d = tc.r;
+    float aaf = fwidth(d);
+    float alpha = smoothstep(0.5 - aaf, 0.5 + aaf, d);
+
+    if (out_shader == SHADER_FOR_IMAGE) {
+        gl_FragColor = tc;
+    } else if (out_shader == SHADER_FOR_TEXT) {
+        gl_FragColor = vec4(out_color.rgb, alpha);
+    } else if (out_shader == SHADER_FOR_EPICNESS) {
+        vec2 frag_uv = gl_FragCoord.xy / resolution;
+        vec4 rainbow = vec4(hsl2rgb(vec3((time + frag_uv.x + frag_uv.y), 0.5, 0.5)), 1.0);
+        gl_FragColor = vec4(rainbow.rgb, alpha);
+    } else {
+        gl_FragColor = out_color;
+    }
+}
@@ -4,6 +4,7 @@ uniform vec2 resolution;
 uniform float time;
 uniform float camera_scale;
 uniform vec2 camera_pos;
+uniform uint shader;
 
 layout(location = 0) in vec2 position;
 layout(location = 1) in vec4 color;
@@ -11,6 +12,7 @@ layout(location = 2) in vec2 uv;
 
 out vec4 out_color;
 out vec2 out_uv;
+flat out uint out_shader;
 
 vec2 camera_project(vec2 point)
 {
@@ -21,4 +23,5 @@ void main() {
     gl_Position = vec4(camera_project(position), 0, 1);
     out_color = color;
     out_uv = uv;
+    out_shader = shader;
 }
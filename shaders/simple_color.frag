@@ -1,7 +0,0 @@
-#version 330 core
-
-in vec4 out_color;
-
-void main() {
-    gl_FragColor = out_color;
-}
@@ -0,0 +1,398 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <SDL2/SDL.h>
+
+#include "./common.h"
+#include "./sv.h"
+#include "./line_index.h"
+#include "./line_index_parallel.h"
+#include "./lexer.h"
+#include "./line_slot.h"
+
+// Microbenchmarks of the text processing parts of the editor.
+// Without the file a synthetic corpus is generated: a log of BENCH_CORPUS_SIZE bytes for lines and
+// C++ code of BENCH_CODE_SIZE bytes for lexer and tokens.
+//
+// $ ./bench lines [file]
+// $ ./bench lexer [file]
+// $ ./bench tokens [file]
+//
+// $ ./bench check runs the sanity checks of the lexer and the cached lines instead.
+
+#define BENCH_CORPUS_SIZE (512*1024*1024)
+#define BENCH_CODE_SIZE (64*1024*1024)
+#define BENCH_CHUNK_SIZE (1024*1024*1024)
+
+static double bench_now(void)
+{
+    return (double) SDL_GetPerformanceCounter() / (double) SDL_GetPerformanceFrequency();
+}
+
+static void bench_report(const char *name, size_t bytes, double secs)
+{
+    printf("%-40s %8.3f s %8.2f GB/s\n", name, secs, (double) bytes / secs / 1e9);
+}
+
+static void generate_log(String_Builder *sb, size_t size)
+{
+    static const char *levels[] = {"INFO", "WARN", "ERROR", "DEBUG"};
+    uint32_t seed = 69;
+    for (size_t i = 0; sb->count < size; ++i) {
+        seed = seed*1664525 + 1013904223;
+        char line[256];
+        int n = snprintf(line, sizeof(line), "[%zu] %s: request %u handled in %u ms by worker-%u\n",
+                         i, levels[seed>>30], seed>>12, (seed>>4)%1000, seed%16);
+        sb_append_buf(sb, line, (size_t) n);
+    }
+}
+
+static void generate_code(String_Builder *sb, size_t size)
+{
+    static const char *lines[] = {
+        "#include <vector>\n",
+        "template <typename T>\n",
+        "class Widget_%u : public Base {\n",
+        "public:\n",
+        "    virtual ~Widget_%u() noexcept = default;\n",
+        "    static constexpr unsigned int capacity = %u;\n",
+        "    const std::vector<T> &items() const { return items_; }\n",
+        "    // TODO: handle the overflow of counter_%u\n",
+        "    if (counter_%u >= capacity && !this->ready) return nullptr;\n",
+        "    for (auto it = items_.begin(); it != items_.end(); ++it) sum += *it;\n",
+        "    throw std::runtime_error(\"widget %u is broken\");\n",
+        "    /* reinterpret_cast<char *>(buffer_%u) */\n",
+        "};\n",
+        "\n",
+    };
+    uint32_t seed = 420;
+    while (sb->count < size) {
+        seed = seed*1664525 + 1013904223;
+        char line[256];
+        int n = snprintf(line, sizeof(line), lines[(seed>>16)%(sizeof(lines)/sizeof(lines[0]))], seed%1000);
+        sb_append_buf(sb, line, (size_t) n);
+    }
+}
+
+typedef struct {
+    Line *items;
+    size_t count;
+    size_t capacity;
+} Lines;
+
+static void bench_lines(String_View text)
+{
+    // The loop editor_retokenize() used to rebuild the lines with on every edit
+    {
+        Lines lines = {0};
+        double begin = bench_now();
+        Line line = {0};
+        for (size_t i = 0; i < text.count; ++i) {
+            if (text.data[i] == '\n') {
+                line.end = i;
+                da_append(&lines, line);
+                line.begin = i + 1;
+            }
+        }
+        line.end = text.count;
+        da_append(&lines, line);
+        bench_report("byte loop", text.count, bench_now() - begin);
+        printf("    %zu lines\n", lines.count);
+        free(lines.items);
+    }
+
+    {
+        Newlines nls = {0};
+        double begin = bench_now();
+        for (size_t i = 0; i < text.count; i += BENCH_CHUNK_SIZE) {
+            size_t n = text.count - i < BENCH_CHUNK_SIZE ? text.count - i : BENCH_CHUNK_SIZE;
+            nls.count = 0;
+            newlines_scan_scalar(&nls, text.data + i, n);
+        }
+        bench_report("newlines_scan_scalar", text.count, bench_now() - begin);
+        free(nls.items);
+    }
+
+    {
+        Newlines nls = {0};
+        double begin = bench_now();
+        for (size_t i = 0; i < text.count; i += BENCH_CHUNK_SIZE) {
+            size_t n = text.count - i < BENCH_CHUNK_SIZE ? text.count - i : BENCH_CHUNK_SIZE;
+            nls.count = 0;
+            newlines_scan(&nls, text.data + i, n);
+        }
+        bench_report("newlines_scan", text.count, bench_now() - begin);
+        free(nls.items);
+    }
+
+    {
+        Line_Index li = {0};
+        double begin = bench_now();
+        line_index_build(&li, text.data, text.count);
+        bench_report("line_index_build", text.count, bench_now() - begin);
+        printf("    %zu lines\n", line_index_count(&li));
+        free(li.nodes.items);
+        free(li.stack.items);
+    }
+
+    {
+        Line_Index li = {0};
+        double begin = bench_now();
+        line_index_build_parallel(&li, text.data, text.count);
+        char name[64];
+        snprintf(name, sizeof(name), "line_index_build_parallel (%d cpus)", SDL_GetCPUCount());
+        bench_report(name, text.count, bench_now() - begin);
+        printf("    %zu lines\n", line_index_count(&li));
+        free(li.nodes.items);
+        free(li.stack.items);
+    }
+}
+
+static bool bench_is_keyword_linear(const char *text, size_t text_len)
+{
+    // The lookup lexer_next() used to classify the symbols with
+    for (size_t i = 0; i < keywords_count; ++i) {
+        size_t keyword_len = strlen(keywords[i]);
+        if (keyword_len == text_len && memcmp(keywords[i], text, keyword_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void bench_lexer(String_View text)
+{
+    Tokens symbols = {0};
+    {
+        size_t tokens_count = 0;
+        double begin = bench_now();
+        Lexer l = lexer_new(text.data, text.count);
+        Token t = lexer_next(&l);
+        while (t.kind != TOKEN_END) {
+            tokens_count += 1;
+            t = lexer_next(&l);
+        }
+        double secs = bench_now() - begin;
+        bench_report("lexer_next", text.count, secs);
+        printf("    %zu tokens, %.2f Mtokens/s\n", tokens_count, (double) tokens_count / secs / 1e6);
+    }
+
+    {
+        Lexer l = lexer_new(text.data, text.count);
+        Token t = lexer_next(&l);
+        while (t.kind != TOKEN_END) {
+            if (t.kind == TOKEN_SYMBOL || t.kind == TOKEN_KEYWORD) da_append(&symbols, t);
+            t = lexer_next(&l);
+        }
+    }
+
+    const struct {
+        const char *name;
+        bool (*is_keyword)(const char *text, size_t text_len);
+    } lookups[] = {
+        {"keywords linear scan", bench_is_keyword_linear},
+        {"keywords perfect hash", lexer_is_keyword},
+    };
+    for (size_t i = 0; i < sizeof(lookups)/sizeof(lookups[0]); ++i) {
+        size_t keywords_found = 0;
+        double begin = bench_now();
+        for (size_t j = 0; j < symbols.count; ++j) {
+            keywords_found += lookups[i].is_keyword(text.data + symbols.items[j].begin, symbols.items[j].text_len);
+        }
+        double secs = bench_now() - begin;
+        printf("%-40s %8.3f s %8.2f Msymbols/s\n", lookups[i].name, secs, (double) symbols.count / secs / 1e6);
+        printf("    %zu of %zu symbols are keywords\n", keywords_found, symbols.count);
+    }
+
+    free(symbols.items);
+}
+
+// The layout of the tokens before they were compacted. The whole file worth of them lived in a
+// single array.
+typedef struct {
+    Token_Kind kind;
+    const char *text;
+    size_t text_len;
+    float position[2];
+} Legacy_Token;
+
+static void bench_report_memory(const char *name, size_t bytes, size_t tokens_count)
+{
+    printf("%-40s %8.2f MB %8.2f bytes/token\n", name, (double) bytes / 1e6, (double) bytes / (double) tokens_count);
+}
+
+static void bench_tokens(String_View text)
+{
+    Tokens scratch = {0};
+    size_t tokens_count = 0;
+    size_t lines_count = 0;
+    size_t compact_bytes = 0;
+    Lexer_State state = LEXER_STATE_NORMAL;
+    double begin = bench_now();
+    while (text.count > 0) {
+        String_View line = sv_chop_by_delim(&text, '\n');
+        Lexer l = lexer_new(line.data, line.count);
+        l.state = state;
+        scratch.count = 0;
+        Token t = lexer_next(&l);
+        while (t.kind != TOKEN_END) {
+            da_append(&scratch, t);
+            t = lexer_next(&l);
+        }
+        state = lexer_line_end_state(&l);
+
+        Compact_Tokens ct = {0};
+        compact_tokens_set(&ct, scratch.items, scratch.count);
+        compact_bytes += ct.count*COMPACT_TOKEN_SIZE;
+        compact_tokens_free(&ct);
+
+        tokens_count += scratch.count;
+        lines_count += 1;
+    }
+    double secs = bench_now() - begin;
+    printf("%zu tokens on %zu lines lexed and compacted in %.3f s\n", tokens_count, lines_count, secs);
+
+    bench_report_memory("Legacy_Token array", tokens_count*sizeof(Legacy_Token), tokens_count);
+    bench_report_memory("Token array", tokens_count*sizeof(Token), tokens_count);
+    bench_report_memory("Compact_Tokens per line", compact_bytes + lines_count*sizeof(Compact_Tokens), tokens_count);
+    printf("    %zu bytes of token data, %zu bytes of per line bookkeeping\n", compact_bytes, lines_count*sizeof(Compact_Tokens));
+
+    free(scratch.items);
+}
+
+// Lexes the lines one by one the way the editor does and returns the first token of the last one
+static Token check_lex_lines(const char *const *lines, size_t lines_count)
+{
+    Lexer_State state = LEXER_STATE_NORMAL;
+    Token first = {0};
+    for (size_t i = 0; i < lines_count; ++i) {
+        Lexer l = lexer_new(lines[i], strlen(lines[i]));
+        l.state = state;
+        first = lexer_next(&l);
+        while (lexer_next(&l).kind != TOKEN_END) {}
+        state = lexer_line_end_state(&l);
+    }
+    return first;
+}
+
+// Lays out the line the way editor_render() does with every character CHECK_ADVANCE pixels wide,
+// stores it into the slot and tells whether the slot is still good when the line is laid out up to
+// pan_max_x instead
+#define CHECK_ADVANCE 10.0f
+static bool check_slot_after_pan(const char *line, float max_x, float pan_max_x)
+{
+    Lexer l = lexer_new(line, strlen(line));
+    size_t tokens_count = 0;
+    size_t laid_out = 0;
+    float len = 0.0f;
+    for (Token t = lexer_next(&l); t.kind != TOKEN_END; t = lexer_next(&l)) {
+        tokens_count += 1;
+        if (t.begin*CHECK_ADVANCE > max_x) continue;
+        laid_out = tokens_count;
+        len = (t.begin + t.text_len)*CHECK_ADVANCE;
+    }
+    Line_Slot slot = {0};
+    line_slot_store(&slot, true, 0, 0, laid_out, tokens_count, len, max_x);
+    return line_slot_reusable(&slot, 0, 0, pan_max_x);
+}
+
+static void bench_check(void)
+{
+    const struct {
+        const char *lines[3];
+        Token_Kind kind;
+    } cases[] = {
+        // The directive ends on the lines without '\' even if there are no tokens on them
+        {{"#define X \\", "", "int x = 1;"}, TOKEN_KEYWORD},
+        {{"#define X \\", "   ", "int x = 1;"}, TOKEN_KEYWORD},
+        {{"#define X \\", "    1 + \\", "    2"}, TOKEN_PREPROC},
+        {{"#define X \\", "    1", "int x = 1;"}, TOKEN_KEYWORD},
+        {{"/* int", "", "*/ int"}, TOKEN_COMMENT},
+    };
+    size_t failed = 0;
+    // The keywords are classified before any lexer is created
+    if (!lexer_is_keyword("int", 3) || lexer_is_keyword("x", 1)) {
+        fprintf(stderr, "FAILED: lexer_is_keyword() before lexer_new()\n");
+        failed += 1;
+    }
+    // The cached line is laid out up to the right edge of the camera. Panning further must not reuse
+    // it if its last token was cut there.
+    {
+        char comment[256];
+        memset(comment, 'x', sizeof(comment) - 1);
+        memcpy(comment, "x = 1; // ", 10);
+        comment[sizeof(comment) - 1] = '\0';
+        if (!check_slot_after_pan("x = 1; // short", 1000.0f, 2000.0f) ||
+            !check_slot_after_pan(comment, 1000.0f, 1000.0f) ||
+            check_slot_after_pan(comment, 1000.0f, 2000.0f)) {
+            fprintf(stderr, "FAILED: reusing the cached line after panning past a long trailing comment\n");
+            failed += 1;
+        }
+    }
+    for (size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); ++i) {
+        Token t = check_lex_lines(cases[i].lines, 3);
+        if (t.kind != cases[i].kind) {
+            fprintf(stderr, "FAILED: case %zu: expected %s but got %s\n", i, token_kind_name(cases[i].kind), token_kind_name(t.kind));
+            failed += 1;
+        }
+    }
+    if (failed > 0) exit(1);
+    printf("OK: %zu cases\n", sizeof(cases)/sizeof(cases[0]));
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s <benchmark> [file]\n", program);
+    fprintf(stderr, "Benchmarks:\n");
+    fprintf(stderr, "    lines     building the line index of the file\n");
+    fprintf(stderr, "    lexer     lexing the file and classifying its keywords\n");
+    fprintf(stderr, "    tokens    memory taken by the tokens of the file\n");
+    fprintf(stderr, "    check     sanity checks of the lexer state and the cached lines\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        usage(argv[0]);
+        fprintf(stderr, "ERROR: no benchmark is provided\n");
+        return 1;
+    }
+    const char *name = argv[1];
+
+    if (strcmp(name, "check") == 0) {
+        bench_check();
+        return 0;
+    }
+
+    String_Builder corpus = {0};
+    if (argc > 2) {
+        const char *file_path = argv[2];
+        Errno err = read_entire_file(file_path, &corpus);
+        if (err != 0) {
+            fprintf(stderr, "ERROR: Could not read file %s: %s\n", file_path, strerror(err));
+            return 1;
+        }
+    } else if (strcmp(name, "lexer") == 0 || strcmp(name, "tokens") == 0) {
+        generate_code(&corpus, BENCH_CODE_SIZE);
+    } else {
+        generate_log(&corpus, BENCH_CORPUS_SIZE);
+    }
+    printf("Corpus: %zu bytes\n", corpus.count);
+
+    if (strcmp(name, "lines") == 0) {
+        bench_lines(sb_to_sv(corpus));
+    } else if (strcmp(name, "lexer") == 0) {
+        bench_lexer(sb_to_sv(corpus));
+    } else if (strcmp(name, "tokens") == 0) {
+        bench_tokens(sb_to_sv(corpus));
+    } else {
+        usage(argv[0]);
+        fprintf(stderr, "ERROR: unknown benchmark %s\n", name);
+        return 1;
+    }
+
+    return 0;
+}
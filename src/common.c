@@ -10,6 +10,8 @@
 #    include <dirent.h>
 #    include <sys/types.h>
 #    include <sys/stat.h>
+#    include <sys/mman.h>
+#    include <fcntl.h>
 #    include <unistd.h>
 #endif // _WIN32
 
@@ -97,7 +99,7 @@ Errno read_entire_file(const char *file_path, String_Builder *sb)
     f = fopen(file_path, "r");
     if (f == NULL) return_defer(errno);
 
-    size_t size;
+    size_t size = 0;
     Errno err = file_size(f, &size);
     if (err != 0) return_defer(err);
 
@@ -147,3 +149,64 @@ Errno type_of_file(const char *file_path, File_Type *ft)
 #endif
     return 0;
 }
+
+Errno stamp_of_file(const char *file_path, File_Stamp *stamp)
+{
+#ifdef _WIN32
+#error "TODO: stamp_of_file() is not implemented for Windows"
+#else
+    struct stat sb = {0};
+    if (stat(file_path, &sb) < 0) return errno;
+    stamp->mtime = (int64_t) sb.st_mtime;
+    stamp->size = (uint64_t) sb.st_size;
+#endif
+    return 0;
+}
+
+Errno map_entire_file(const char *file_path, Mapped_File *mf)
+{
+#ifdef _WIN32
+#error "TODO: map_entire_file() is not implemented for Windows"
+#else
+    Errno result = 0;
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) return errno;
+
+    struct stat sb = {0};
+    if (fstat(fd, &sb) < 0) return_defer(errno);
+
+    mf->size = (size_t) sb.st_size;
+    mf->data = NULL;
+    if (mf->size > 0) {
+        void *data = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) return_defer(errno);
+        mf->data = data;
+    }
+
+defer:
+    // NOTE: the mapping outlives the descriptor
+    close(fd);
+    return result;
+#endif
+}
+
+void unmap_entire_file(Mapped_File *mf)
+{
+#ifdef _WIN32
+#error "TODO: unmap_entire_file() is not implemented for Windows"
+#else
+    if (mf->data != NULL) munmap(mf->data, mf->size);
+    mf->data = NULL;
+    mf->size = 0;
+#endif
+}
+
+Errno make_dir(const char *dir_path)
+{
+#ifdef _WIN32
+#error "TODO: make_dir() is not implemented for Windows"
+#else
+    if (mkdir(dir_path, 0755) < 0 && errno != EEXIST) return errno;
+#endif
+    return 0;
+}
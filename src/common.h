@@ -104,7 +104,23 @@ typedef enum {
     FT_OTHER,
 } File_Type;
 
+typedef struct {
+    int64_t mtime;
+    uint64_t size;
+} File_Stamp;
+
+// Read-only mapping of the whole file. The empty files are mapped as data == NULL.
+typedef struct {
+    void *data;
+    size_t size;
+} Mapped_File;
+
 Errno type_of_file(const char *file_path, File_Type *ft);
+Errno stamp_of_file(const char *file_path, File_Stamp *stamp);
+Errno map_entire_file(const char *file_path, Mapped_File *mf);
+void unmap_entire_file(Mapped_File *mf);
+// Succeeds if the directory already exists
+Errno make_dir(const char *dir_path);
 Errno read_entire_file(const char *file_path, String_Builder *sb);
 Errno write_entire_file(const char *file_path, const char *buf, size_t buf_size);
 Errno read_entire_dir(const char *dir_path, Files *files);
@@ -5,6 +5,31 @@
 #include <string.h>
 #include "./editor.h"
 #include "./common.h"
+#include "./utf8.h"
+#include "./line_index_parallel.h"
+
+// The cursor moves over whole UTF-8 sequences. Stray continuation bytes are stepped over in groups of
+// at most 3, same as the longest sequence.
+static size_t editor_prev_char(const Editor *e, size_t pos)
+{
+    assert(pos > 0);
+    pos -= 1;
+    for (size_t i = 0; i < 3 && pos > 0 && utf8_is_continuation(piece_table_char_at(&e->data, pos)); ++i) {
+        pos -= 1;
+    }
+    return pos;
+}
+
+static size_t editor_next_char(const Editor *e, size_t pos)
+{
+    size_t count = piece_table_count(&e->data);
+    assert(pos < count);
+    pos += 1;
+    for (size_t i = 0; i < 3 && pos < count && utf8_is_continuation(piece_table_char_at(&e->data, pos)); ++i) {
+        pos += 1;
+    }
+    return pos;
+}
 
 void editor_backspace(Editor *e)
 {
@@ -13,19 +38,16 @@ void editor_backspace(Editor *e)
             e->search.count -= 1;
         }
     } else {
-        if (e->cursor > e->data.count) {
-            e->cursor = e->data.count;
+        size_t count = piece_table_count(&e->data);
+        if (e->cursor > count) {
+            e->cursor = count;
         }
         if (e->cursor == 0) return;
 
-        memmove(
-            &e->data.items[e->cursor - 1],
-            &e->data.items[e->cursor],
-            e->data.count - e->cursor
-        );
-        e->cursor -= 1;
-        e->data.count -= 1;
-        editor_retokenize(e);
+        size_t begin = editor_prev_char(e, e->cursor);
+        piece_table_delete(&e->data, begin, e->cursor - begin);
+        line_index_delete(&e->lines, begin, e->cursor - begin);
+        e->cursor = begin;
     }
 }
 
@@ -33,14 +55,10 @@ void editor_delete(Editor *e)
 {
     if (e->searching) return;
 
-    if (e->cursor >= e->data.count) return;
-    memmove(
-        &e->data.items[e->cursor],
-        &e->data.items[e->cursor + 1],
-        e->data.count - e->cursor - 1
-    );
-    e->data.count -= 1;
-    editor_retokenize(e);
+    if (e->cursor >= piece_table_count(&e->data)) return;
+    size_t end = editor_next_char(e, e->cursor);
+    piece_table_delete(&e->data, e->cursor, end - e->cursor);
+    line_index_delete(&e->lines, e->cursor, end - e->cursor);
 }
 
 // TODO: make sure that you always have new line at the end of the file while saving
@@ -49,7 +67,7 @@ void editor_delete(Editor *e)
 Errno editor_save_as(Editor *e, const char *file_path)
 {
     printf("Saving as %s...\n", file_path);
-    Errno err = write_entire_file(file_path, e->data.items, e->data.count);
+    Errno err = piece_table_save_to_file(&e->data, file_path);
     if (err != 0) return err;
     e->file_path.count = 0;
     sb_append_cstr(&e->file_path, file_path);
@@ -61,20 +79,22 @@ Errno editor_save(const Editor *e)
 {
     assert(e->file_path.count > 0);
     printf("Saving as %s...\n", e->file_path.items);
-    return write_entire_file(e->file_path.items, e->data.items, e->data.count);
+    return piece_table_save_to_file(&e->data, e->file_path.items);
 }
 
 Errno editor_load_from_file(Editor *e, const char *file_path)
 {
     printf("Loading %s\n", file_path);
 
-    e->data.count = 0;
-    Errno err = read_entire_file(file_path, &e->data);
+    Errno err = piece_table_load_from_file(&e->data, file_path);
     if (err != 0) return err;
 
-    e->cursor = 0;
+    // NOTE: the freshly loaded text is a single piece
+    String_View text = piece_table_chunk(&e->data, 0);
+    assert(text.count == piece_table_count(&e->data));
+    line_index_build_parallel(&e->lines, text.data, text.count);
 
-    editor_retokenize(e);
+    e->cursor = 0;
 
     e->file_path.count = 0;
     sb_append_cstr(&e->file_path, file_path);
@@ -85,14 +105,7 @@ Errno editor_load_from_file(Editor *e, const char *file_path)
 
 size_t editor_cursor_row(const Editor *e)
 {
-    assert(e->lines.count > 0);
-    for (size_t row = 0; row < e->lines.count; ++row) {
-        Line line = e->lines.items[row];
-        if (line.begin <= e->cursor && e->cursor <= line.end) {
-            return row;
-        }
-    }
-    return e->lines.count - 1;
+    return line_index_row(&e->lines, e->cursor);
 }
 
 void editor_move_line_up(Editor *e)
@@ -100,9 +113,9 @@ void editor_move_line_up(Editor *e)
     editor_stop_search(e);
 
     size_t cursor_row = editor_cursor_row(e);
-    size_t cursor_col = e->cursor - e->lines.items[cursor_row].begin;
+    size_t cursor_col = e->cursor - line_index_line(&e->lines, cursor_row).begin;
     if (cursor_row > 0) {
-        Line next_line = e->lines.items[cursor_row - 1];
+        Line next_line = line_index_line(&e->lines, cursor_row - 1);
         size_t next_line_size = next_line.end - next_line.begin;
         if (cursor_col > next_line_size) cursor_col = next_line_size;
         e->cursor = next_line.begin + cursor_col;
@@ -114,9 +127,9 @@ void editor_move_line_down(Editor *e)
     editor_stop_search(e);
 
     size_t cursor_row = editor_cursor_row(e);
-    size_t cursor_col = e->cursor - e->lines.items[cursor_row].begin;
-    if (cursor_row < e->lines.count - 1) {
-        Line next_line = e->lines.items[cursor_row + 1];
+    size_t cursor_col = e->cursor - line_index_line(&e->lines, cursor_row).begin;
+    if (cursor_row < line_index_count(&e->lines) - 1) {
+        Line next_line = line_index_line(&e->lines, cursor_row + 1);
         size_t next_line_size = next_line.end - next_line.begin;
         if (cursor_col > next_line_size) cursor_col = next_line_size;
         e->cursor = next_line.begin + cursor_col;
@@ -126,22 +139,22 @@ void editor_move_line_down(Editor *e)
 void editor_move_char_left(Editor *e)
 {
     editor_stop_search(e);
-    if (e->cursor > 0) e->cursor -= 1;
+    if (e->cursor > 0) e->cursor = editor_prev_char(e, e->cursor);
 }
 
 void editor_move_char_right(Editor *e)
 {
     editor_stop_search(e);
-    if (e->cursor < e->data.count) e->cursor += 1;
+    if (e->cursor < piece_table_count(&e->data)) e->cursor = editor_next_char(e, e->cursor);
 }
 
 void editor_move_word_left(Editor *e)
 {
     editor_stop_search(e);
-    while (e->cursor > 0 && !isalnum(e->data.items[e->cursor - 1])) {
+    while (e->cursor > 0 && !isalnum(piece_table_char_at(&e->data, e->cursor - 1))) {
         e->cursor -= 1;
     }
-    while (e->cursor > 0 && isalnum(e->data.items[e->cursor - 1])) {
+    while (e->cursor > 0 && isalnum(piece_table_char_at(&e->data, e->cursor - 1))) {
         e->cursor -= 1;
     }
 }
@@ -149,10 +162,11 @@ void editor_move_word_left(Editor *e)
 void editor_move_word_right(Editor *e)
 {
     editor_stop_search(e);
-    while (e->cursor < e->data.count && !isalnum(e->data.items[e->cursor])) {
+    size_t count = piece_table_count(&e->data);
+    while (e->cursor < count && !isalnum(piece_table_char_at(&e->data, e->cursor))) {
         e->cursor += 1;
     }
-    while (e->cursor < e->data.count && isalnum(e->data.items[e->cursor])) {
+    while (e->cursor < count && isalnum(piece_table_char_at(&e->data, e->cursor))) {
         e->cursor += 1;
     }
 }
@@ -162,12 +176,13 @@ void editor_insert_char(Editor *e, char x)
     editor_insert_buf(e, &x, 1);
 }
 
-void editor_insert_buf(Editor *e, char *buf, size_t buf_len)
+void editor_insert_buf(Editor *e, const char *buf, size_t buf_len)
 {
     if (e->searching) {
         sb_append_buf(&e->search, buf, buf_len);
         bool matched = false;
-        for (size_t pos = e->cursor; pos < e->data.count; ++pos) {
+        size_t count = piece_table_count(&e->data);
+        for (size_t pos = e->cursor; pos < count; ++pos) {
             if (editor_search_matches_at(e, pos)) {
                 e->cursor = pos;
                 matched = true;
@@ -176,53 +191,83 @@ void editor_insert_buf(Editor *e, char *buf, size_t buf_len)
         }
         if (!matched) e->search.count -= buf_len;
     } else {
-        if (e->cursor > e->data.count) {
-            e->cursor = e->data.count;
+        size_t count = piece_table_count(&e->data);
+        if (e->cursor > count) {
+            e->cursor = count;
         }
 
-        for (size_t i = 0; i < buf_len; ++i) {
-            da_append(&e->data, '\0');
-        }
-        memmove(
-            &e->data.items[e->cursor + buf_len],
-            &e->data.items[e->cursor],
-            e->data.count - e->cursor - buf_len
-        );
-        memcpy(&e->data.items[e->cursor], buf, buf_len);
+        piece_table_insert(&e->data, e->cursor, buf, buf_len);
+        line_index_insert(&e->lines, e->cursor, buf, buf_len);
         e->cursor += buf_len;
-        editor_retokenize(e);
     }
 }
 
-void editor_retokenize(Editor *e)
+// Contiguous view of the [begin, end) range of the text. Points directly into the piece table if
+// the range does not cross a piece boundary, otherwise the range is copied into the arena.
+static String_View editor_text_view(const Editor *e, size_t begin, size_t end, Arena *arena)
 {
-    // Lines
-    {
-        e->lines.count = 0;
-
-        Line line;
-        line.begin = 0;
+    assert(begin <= end);
+    size_t count = end - begin;
+    String_View chunk = piece_table_chunk(&e->data, begin);
+    if (chunk.count >= count) {
+        return sv_from_parts(chunk.data, count);
+    }
 
-        for (size_t i = 0; i < e->data.count; ++i) {
-            if (e->data.items[i] == '\n') {
-                line.end = i;
-                da_append(&e->lines, line);
-                line.begin = i + 1;
-            }
-        }
+    char *text = arena_alloc(arena, count);
+    for (size_t i = 0; i < count;) {
+        chunk = piece_table_chunk(&e->data, begin + i);
+        size_t n = chunk.count < count - i ? chunk.count : count - i;
+        memcpy(text + i, chunk.data, n);
+        i += n;
+    }
+    return sv_from_parts(text, count);
+}
 
-        line.end = e->data.count;
-        da_append(&e->lines, line);
+// Lexes the line starting in the given state and caches the tokens in the line index.
+// Returns the state of the lexer at the end of the line.
+static Lexer_State editor_lex_line(Editor *e, size_t row, Lexer_State state)
+{
+    arena_reset(&e->tokens_arena);
+    Line line = line_index_line(&e->lines, row);
+    String_View text = editor_text_view(e, line.begin, line.end, &e->tokens_arena);
+    // NOTE: the offsets of the cached tokens are 32 bit. The rest of an absurdly long line is just
+    // not highlighted.
+    if (text.count > UINT32_MAX) text.count = UINT32_MAX;
+
+    Lexer l = lexer_new(text.data, text.count);
+    l.state = state;
+    e->tokens.count = 0;
+    Token t = lexer_next(&l);
+    while (t.kind != TOKEN_END) {
+        da_append(&e->tokens, t);
+        t = lexer_next(&l);
     }
 
+    Line_Node *node = line_index_node(&e->lines, row);
+    node->lexer_state = state;
+    compact_tokens_set(&node->tokens, e->tokens.items, e->tokens.count);
+    node->version = ++e->lines.versions;
+    line_index_clean(&e->lines, row);
+
+    return lexer_line_end_state(&l);
+}
+
+void editor_retokenize(Editor *e)
+{
     // Syntax Highlighting
     {
-        e->tokens.count = 0;
-        Lexer l = lexer_new(e->atlas, e->data.items, e->data.count);
-        Token t = lexer_next(&l);
-        while (t.kind != TOKEN_END) {
-            da_append(&e->tokens, t);
-            t = lexer_next(&l);
+        // NOTE: none of the tokens span several lines, so only the dirty lines are lexed again. The
+        // lexing goes on past them until it reaches a clean line that starts in the same state as
+        // before, e.g. after opening or closing a block comment.
+        size_t row = 0;
+        while (line_index_next_dirty(&e->lines, row, &row)) {
+            Lexer_State state = line_index_node(&e->lines, row)->lexer_state;
+            size_t lines_count = line_index_count(&e->lines);
+            for (; row < lines_count; ++row) {
+                const Line_Node *node = line_index_node(&e->lines, row);
+                if (!node->dirty && node->lexer_state == state) break;
+                state = editor_lex_line(e, row, state);
+            }
         }
     }
 }
@@ -233,12 +278,12 @@ bool editor_line_starts_with(Editor *e, size_t row, size_t col, const char *pref
     if (prefix_len == 0) {
         return true;
     }
-    Line line = e->lines.items[row];
+    Line line = line_index_line(&e->lines, row);
     if (col + prefix_len - 1 >= line.end) {
         return false;
     }
     for (size_t i = 0; i < prefix_len; ++i) {
-        if (prefix[i] != e->data.items[line.begin + col + i]) {
+        if (prefix[i] != piece_table_char_at(&e->data, line.begin + col + i)) {
             return false;
         }
     }
@@ -255,6 +300,67 @@ const char *editor_line_starts_with_one_of(Editor *e, size_t row, size_t col, co
     return NULL;
 }
 
+// Positions of the tokens of a single line on the screen. The lexer knows only their offsets within
+// the line, so the layout is computed separately and only for the lines that are rendered.
+//
+// Only the tokens that start before max_x are laid out. Returns their amount n. positions must have
+// room for tokens->count + 1 elements: positions[n] is where the last laid out token ends.
+static size_t editor_layout_line(Free_Glyph_Atlas *atlas, String_View text, const Compact_Tokens *tokens, float y, float max_x, Vec2f *positions)
+{
+    Vec2f pos = vec2f(0.0f, y);
+    size_t measured = 0;
+    size_t n = 0;
+    for (; n < tokens->count; ++n) {
+        size_t begin = compact_tokens_get(tokens, n).begin;
+        free_glyph_atlas_measure_line_sized(atlas, text.data + measured, begin - measured, &pos);
+        if (pos.x > max_x) break;
+        positions[n] = pos;
+        measured = begin;
+    }
+    if (n > 0) {
+        Token last = compact_tokens_get(tokens, n - 1);
+        pos = positions[n - 1];
+        free_glyph_atlas_measure_line_sized(atlas, text.data + last.begin, last.text_len, &pos);
+    }
+    positions[n] = pos;
+    return n;
+}
+
+// Renders only the glyphs of the text that fall within [min_x, max_x] horizontally, so very long
+// tokens like minified code or huge comments do not produce geometry outside of the screen.
+static void editor_render_clipped(Free_Glyph_Atlas *atlas, Simple_Renderer *sr, const char *text, size_t text_size, Vec2f *pos, Vec4f color, float min_x, float max_x)
+{
+    size_t begin = 0;
+    while (begin < text_size) {
+        Vec2f next = *pos;
+        size_t len = free_glyph_atlas_measure_char(atlas, text + begin, text_size - begin, &next);
+        if (next.x >= min_x) break;
+        *pos = next;
+        begin += len;
+    }
+
+    size_t end = begin;
+    Vec2f end_pos = *pos;
+    while (end < text_size && end_pos.x <= max_x) {
+        end += free_glyph_atlas_measure_char(atlas, text + end, text_size - end, &end_pos);
+    }
+
+    free_glyph_atlas_render_line_sized(atlas, sr, text + begin, end - begin, pos, color);
+}
+
+static bool editor_layer_key_eq(const Editor_Layer_Key *a, const Editor_Layer_Key *b)
+{
+    return a->resolution.x == b->resolution.x && a->resolution.y == b->resolution.y &&
+           a->camera_pos.x == b->camera_pos.x && a->camera_pos.y == b->camera_pos.y &&
+           a->camera_scale == b->camera_scale &&
+           a->versions == b->versions &&
+           a->selection == b->selection &&
+           a->select_begin == b->select_begin &&
+           a->cursor == b->cursor &&
+           a->searching == b->searching &&
+           a->search_width == b->search_width;
+}
+
 void editor_render(SDL_Window *window, Free_Glyph_Atlas *atlas, Simple_Renderer *sr, Editor *editor)
 {
     int w, h;
@@ -265,18 +371,86 @@ void editor_render(SDL_Window *window, Free_Glyph_Atlas *atlas, Simple_Renderer
     sr->resolution = vec2f(w, h);
     sr->time = (float) SDL_GetTicks() / 1000.0f;
 
+    // The part of the world the camera sees. Only the lines and glyphs within it are rendered, so the
+    // cost of the frame depends on the size of the screen rather than the size of the file.
+    Vec2f view_half = vec2f(w/2/sr->camera_scale, h/2/sr->camera_scale);
+    Vec2f view_min = vec2f_sub(sr->camera_pos, view_half);
+    Vec2f view_max = vec2f_add(sr->camera_pos, view_half);
+
+    // The lines go down from y = 0, the glyphs of the line `row` are within roughly
+    // (-(row + 1)*FREE_GLYPH_FONT_SIZE, -(row - 1)*FREE_GLYPH_FONT_SIZE)
+    size_t lines_count = line_index_count(&editor->lines);
+    size_t rows_begin = 0;
+    size_t rows_end = 0;
+    {
+        float top = -view_max.y/FREE_GLYPH_FONT_SIZE - 1.0f;
+        float bottom = -view_min.y/FREE_GLYPH_FONT_SIZE + 2.0f;
+        if (top > 0.0f) rows_begin = top < (float) lines_count ? (size_t) top : lines_count;
+        if (bottom > 0.0f) rows_end = bottom < (float) lines_count ? (size_t) bottom : lines_count;
+    }
+
+    arena_reset(&editor->render_arena);
+
+    // NOTE: the edits only mark the lines they touch as dirty. All of them are lexed here at once,
+    // so a burst of edits within a single frame costs a single retokenization.
+    editor_retokenize(editor);
+
+    Vec2f cursor_pos = vec2fs(0.0f);
+    {
+        size_t cursor_row = editor_cursor_row(editor);
+        Line line = line_index_line(&editor->lines, cursor_row);
+        size_t cursor_col = editor->cursor - line.begin;
+        String_View text = editor_text_view(editor, line.begin, line.end, &editor->render_arena);
+        cursor_pos.y = -((float)cursor_row + CURSOR_OFFSET) * FREE_GLYPH_FONT_SIZE;
+        cursor_pos.x = free_glyph_atlas_cursor_pos(
+                           atlas,
+                           text.data, text.count,
+                           vec2f(0.0, cursor_pos.y),
+                           cursor_col
+                       );
+    }
+
+    float search_width = 0.0f;
+    if (editor->searching) {
+        Vec2f p = cursor_pos;
+        free_glyph_atlas_measure_line_sized(editor->atlas, editor->search.items, editor->search.count, &p);
+        search_width = p.x - cursor_pos.x;
+    }
+
+    // The selection, the search and the text are rendered into the layer of the renderer which is
+    // reused for as long as none of them has changed and the camera stays still. The frames that
+    // only blink the cursor just composite the layer and draw the cursor on top of it.
+    Editor_Layer_Key layer_key = {
+        .resolution = sr->resolution,
+        .camera_pos = sr->camera_pos,
+        .camera_scale = sr->camera_scale,
+        .versions = editor->lines.versions,
+        .selection = editor->selection,
+        .select_begin = editor->selection ? editor->select_begin : 0,
+        .cursor = editor->selection || editor->searching ? editor->cursor : 0,
+        .searching = editor->searching,
+        .search_width = search_width,
+    };
+    bool layer_reused = editor->layer_valid && editor_layer_key_eq(&editor->layer_key, &layer_key);
+    bool layered = false;
+    if (layer_reused) {
+        max_line_len = editor->layer_max_line_len;
+    } else {
+        layered = simple_renderer_layer_begin(sr, w, h);
+    }
+
     // Render selection
     {
         simple_renderer_set_shader(sr, SHADER_FOR_COLOR);
-        if (editor->selection) {
-            for (size_t row = 0; row < editor->lines.count; ++row) {
+        if (!layer_reused && editor->selection) {
+            for (size_t row = rows_begin; row < rows_end; ++row) {
                 size_t select_begin_chr = editor->select_begin;
                 size_t select_end_chr = editor->cursor;
                 if (select_begin_chr > select_end_chr) {
                     SWAP(size_t, select_begin_chr, select_end_chr);
                 }
 
-                Line line_chr = editor->lines.items[row];
+                Line line_chr = line_index_line(&editor->lines, row);
 
                 if (select_begin_chr < line_chr.begin) {
                     select_begin_chr = line_chr.begin;
@@ -287,14 +461,16 @@ void editor_render(SDL_Window *window, Free_Glyph_Atlas *atlas, Simple_Renderer
                 }
 
                 if (select_begin_chr <= select_end_chr) {
+                    String_View text = editor_text_view(editor, line_chr.begin, select_end_chr, &editor->render_arena);
+
                     Vec2f select_begin_scr = vec2f(0, -((float)row + CURSOR_OFFSET) * FREE_GLYPH_FONT_SIZE);
                     free_glyph_atlas_measure_line_sized(
-                        atlas, editor->data.items + line_chr.begin, select_begin_chr - line_chr.begin,
+                        atlas, text.data, select_begin_chr - line_chr.begin,
                         &select_begin_scr);
 
                     Vec2f select_end_scr = select_begin_scr;
                     free_glyph_atlas_measure_line_sized(
-                        atlas, editor->data.items + select_begin_chr, select_end_chr - select_begin_chr,
+                        atlas, text.data + select_begin_chr - line_chr.begin, select_end_chr - select_begin_chr,
                         &select_end_scr);
 
                     Vec4f selection_color = vec4f(.25, .25, .25, 1);
@@ -302,85 +478,105 @@ void editor_render(SDL_Window *window, Free_Glyph_Atlas *atlas, Simple_Renderer
                 }
             }
         }
-        simple_renderer_flush(sr);
-    }
-
-    Vec2f cursor_pos = vec2fs(0.0f);
-    {
-        size_t cursor_row = editor_cursor_row(editor);
-        Line line = editor->lines.items[cursor_row];
-        size_t cursor_col = editor->cursor - line.begin;
-        cursor_pos.y = -((float)cursor_row + CURSOR_OFFSET) * FREE_GLYPH_FONT_SIZE;
-        cursor_pos.x = free_glyph_atlas_cursor_pos(
-                           atlas,
-                           editor->data.items + line.begin, line.end - line.begin,
-                           vec2f(0.0, cursor_pos.y),
-                           cursor_col
-                       );
     }
 
     // Render search
     {
-        if (editor->searching) {
+        if (!layer_reused && editor->searching) {
             simple_renderer_set_shader(sr, SHADER_FOR_COLOR);
             Vec4f selection_color = vec4f(.10, .10, .25, 1);
-            Vec2f p1 = cursor_pos;
-            Vec2f p2 = p1;
-            free_glyph_atlas_measure_line_sized(editor->atlas, editor->search.items, editor->search.count, &p2);
-            simple_renderer_solid_rect(sr, p1, vec2f(p2.x - p1.x, FREE_GLYPH_FONT_SIZE), selection_color);
-            simple_renderer_flush(sr);
+            simple_renderer_solid_rect(sr, cursor_pos, vec2f(search_width, FREE_GLYPH_FONT_SIZE), selection_color);
         }
     }
 
     // Render text
-    {
+    if (!layer_reused) {
         simple_renderer_set_shader(sr, SHADER_FOR_TEXT);
-        for (size_t i = 0; i < editor->tokens.count; ++i) {
-            Token token = editor->tokens.items[i];
-            Vec2f pos = token.position;
-            Vec4f color = vec4fs(1);
-            switch (token.kind) {
-            case TOKEN_PREPROC:
-                color = hex_to_vec4f(0x95A99FFF);
-                break;
-            case TOKEN_KEYWORD:
-                color = hex_to_vec4f(0xFFDD33FF);
-                break;
-            case TOKEN_COMMENT:
-                color = hex_to_vec4f(0xCC8C3CFF);
-                break;
-            case TOKEN_STRING:
-                color = hex_to_vec4f(0x73c936ff);
-                break;
-            default:
-            {}
+        // NOTE: the camera zooms out to fit the lines up to 1000 pixels long, so the lines are laid
+        // out at least that far even if they are not visible.
+        float layout_max_x = view_max.x > 1000.0f ? view_max.x : 1000.0f;
+
+        // The geometry of the visible lines stays in the cache of the renderer. The line `row` lives
+        // in the slot row % SIMPLE_CACHE_SLOTS and is regenerated only if it was edited, moved to
+        // another row or is laid out further than before. If the camera sees more lines than there
+        // are slots, the lines are streamed every frame instead.
+        bool cached = rows_end - rows_begin <= SIMPLE_CACHE_SLOTS;
+        // The cached lines are not clipped by the camera, so they stay valid while it moves
+        float clip_min_x = cached ? 0.0f : view_min.x;
+        float clip_max_x = cached ? layout_max_x : view_max.x;
+
+        for (size_t row = rows_begin; row < rows_end; ++row) {
+            const Line_Node *node = line_index_node(&editor->lines, row);
+            Line_Slot *slot = &editor->line_slots[row%SIMPLE_CACHE_SLOTS];
+            if (cached && line_slot_reusable(slot, row, node->version, layout_max_x)) {
+                if (max_line_len < slot->len) max_line_len = slot->len;
+                continue;
+            }
+
+            if (cached) simple_renderer_cache_begin(sr, row%SIMPLE_CACHE_SLOTS);
+            Line line = line_index_line(&editor->lines, row);
+            String_View text = editor_text_view(editor, line.begin, line.end, &editor->render_arena);
+            Vec2f *positions = arena_alloc(&editor->render_arena, (node->tokens.count + 1)*sizeof(*positions));
+            size_t laid_out = editor_layout_line(atlas, text, &node->tokens, -(float)row * FREE_GLYPH_FONT_SIZE, layout_max_x, positions);
+            if (max_line_len < positions[laid_out].x) max_line_len = positions[laid_out].x;
+            for (size_t i = 0; i < laid_out; ++i) {
+                if (positions[i].x > clip_max_x) break;
+                if (positions[i + 1].x < clip_min_x) continue;
+                Token token = compact_tokens_get(&node->tokens, i);
+                Vec2f pos = positions[i];
+                Vec4f color = vec4fs(1);
+                switch (token.kind) {
+                case TOKEN_PREPROC:
+                    color = hex_to_vec4f(0x95A99FFF);
+                    break;
+                case TOKEN_KEYWORD:
+                    color = hex_to_vec4f(0xFFDD33FF);
+                    break;
+                case TOKEN_COMMENT:
+                    color = hex_to_vec4f(0xCC8C3CFF);
+                    break;
+                case TOKEN_STRING:
+                    color = hex_to_vec4f(0x73c936ff);
+                    break;
+                default:
+                {}
+                }
+                editor_render_clipped(atlas, sr, text.data + token.begin, token.text_len, &pos, color, clip_min_x, clip_max_x);
+            }
+            if (cached) {
+                // NOTE: the lines that do not fit into the slot are regenerated every frame. So are the
+                // lines with non-ASCII characters, since their glyphs could be evicted from the atlas
+                // by the time the slot is drawn again.
+                bool valid = simple_renderer_cache_end(sr) && utf8_ascii_prefix(text.data, text.count) == text.count;
+                line_slot_store(slot, valid, row, node->version, laid_out, node->tokens.count, positions[laid_out].x, layout_max_x);
             }
-            free_glyph_atlas_render_line_sized(atlas, sr, token.text, token.text_len, &pos, color);
-            // TODO: the max_line_len should be calculated based on what's visible on the screen right now
-            if (max_line_len < pos.x) max_line_len = pos.x;
         }
-        simple_renderer_flush(sr);
+
+        if (cached) simple_renderer_cache_draw(sr, rows_begin%SIMPLE_CACHE_SLOTS, rows_end - rows_begin);
     }
 
+    if (layered) {
+        simple_renderer_layer_end(sr);
+        editor->layer_key = layer_key;
+        editor->layer_max_line_len = max_line_len;
+    }
+    if (!layer_reused) editor->layer_valid = layered;
+    if (editor->layer_valid) simple_renderer_layer_draw(sr);
+
     // Render cursor
     simple_renderer_set_shader(sr, SHADER_FOR_COLOR);
     {
         float CURSOR_WIDTH = 5.0f;
-        Uint32 CURSOR_BLINK_THRESHOLD = 500;
-        Uint32 CURSOR_BLINK_PERIOD = 1000;
-        Uint32 t = SDL_GetTicks() - editor->last_stroke;
-
-        sr->verticies_count = 0;
-        if (t < CURSOR_BLINK_THRESHOLD || t/CURSOR_BLINK_PERIOD%2 != 0) {
+        if (editor_cursor_visible(editor, SDL_GetTicks())) {
             simple_renderer_solid_rect(
                 sr,
                 cursor_pos, vec2f(CURSOR_WIDTH, FREE_GLYPH_FONT_SIZE),
                 vec4fs(1));
         }
-
-        simple_renderer_flush(sr);
     }
 
+    simple_renderer_flush(sr);
+
     // Update camera
     {
         if (max_line_len > 1000.0f) {
@@ -405,11 +601,32 @@ void editor_render(SDL_Window *window, Free_Glyph_Atlas *atlas, Simple_Renderer
                              vec2fs(2.0f));
         sr->camera_scale_vel = (target_scale - sr->camera_scale) * 2.0f;
 
-        sr->camera_pos = vec2f_add(sr->camera_pos, vec2f_mul(sr->camera_vel, vec2fs(DELTA_TIME)));
-        sr->camera_scale = sr->camera_scale + sr->camera_scale_vel * DELTA_TIME;
+        if (simple_renderer_camera_settled(sr)) {
+            // Snap it, so the camera stays exactly still and the layer is reused from now on
+            sr->camera_pos = target;
+            sr->camera_scale = target_scale;
+            sr->camera_vel = vec2fs(0.0f);
+            sr->camera_scale_vel = 0.0f;
+        } else {
+            sr->camera_pos = vec2f_add(sr->camera_pos, vec2f_mul(sr->camera_vel, vec2fs(DELTA_TIME)));
+            sr->camera_scale = sr->camera_scale + sr->camera_scale_vel * DELTA_TIME;
+        }
     }
 }
 
+bool editor_cursor_visible(const Editor *e, Uint32 now)
+{
+    Uint32 t = now - e->last_stroke;
+    return t < CURSOR_BLINK_THRESHOLD || t/CURSOR_BLINK_PERIOD%2 != 0;
+}
+
+Uint32 editor_cursor_next_blink(const Editor *e, Uint32 now)
+{
+    Uint32 t = now - e->last_stroke;
+    if (t < CURSOR_BLINK_THRESHOLD) return CURSOR_BLINK_THRESHOLD - t;
+    return CURSOR_BLINK_PERIOD - t%CURSOR_BLINK_PERIOD;
+}
+
 void editor_update_selection(Editor *e, bool shift)
 {
     if (e->searching) return;
@@ -433,8 +650,13 @@ void editor_clipboard_copy(Editor *e)
         size_t end = e->cursor;
         if (begin > end) SWAP(size_t, begin, end);
 
+        size_t count = end - begin + 1;
+        if (begin + count > piece_table_count(&e->data)) {
+            count = piece_table_count(&e->data) - begin;
+        }
+
         e->clipboard.count = 0;
-        sb_append_buf(&e->clipboard, &e->data.items[begin], end - begin + 1);
+        piece_table_read(&e->data, begin, count, &e->clipboard);
         sb_append_null(&e->clipboard);
 
         if (SDL_SetClipboardText(e->clipboard.items) < 0) {
@@ -458,7 +680,8 @@ void editor_clipboard_paste(Editor *e)
 void editor_start_search(Editor *e)
 {
     if (e->searching) {
-        for (size_t pos = e->cursor + 1; pos < e->data.count; ++pos) {
+        size_t count = piece_table_count(&e->data);
+        for (size_t pos = e->cursor + 1; pos < count; ++pos) {
             if (editor_search_matches_at(e, pos)) {
                 e->cursor = pos;
                 break;
@@ -482,10 +705,13 @@ void editor_stop_search(Editor *e)
 
 bool editor_search_matches_at(Editor *e, size_t pos)
 {
-    if (e->data.count - pos < e->search.count) return false;
-    for (size_t i = 0; i < e->search.count; ++i) {
-        if (e->search.items[i] != e->data.items[pos + i]) {
-            return false;
+    if (piece_table_count(&e->data) - pos < e->search.count) return false;
+    for (size_t i = 0; i < e->search.count;) {
+        String_View chunk = piece_table_chunk(&e->data, pos + i);
+        for (size_t j = 0; j < chunk.count && i < e->search.count; ++j, ++i) {
+            if (e->search.items[i] != chunk.data[j]) {
+                return false;
+            }
         }
     }
     return true;
@@ -500,45 +726,52 @@ void editor_move_to_begin(Editor *e)
 void editor_move_to_end(Editor *e)
 {
     editor_stop_search(e);
-    e->cursor = e->data.count;
+    e->cursor = piece_table_count(&e->data);
 }
 
 void editor_move_to_line_begin(Editor *e)
 {
     editor_stop_search(e);
     size_t row = editor_cursor_row(e);
-    e->cursor = e->lines.items[row].begin;
+    e->cursor = line_index_line(&e->lines, row).begin;
 }
 
 void editor_move_to_line_end(Editor *e)
 {
     editor_stop_search(e);
     size_t row = editor_cursor_row(e);
-    e->cursor = e->lines.items[row].end;
+    e->cursor = line_index_line(&e->lines, row).end;
+}
+
+static size_t editor_line_len(const Editor *e, size_t row)
+{
+    Line line = line_index_line(&e->lines, row);
+    return line.end - line.begin;
 }
 
 void editor_move_paragraph_up(Editor *e)
 {
     editor_stop_search(e);
     size_t row = editor_cursor_row(e);
-    while (row > 0 && e->lines.items[row].end - e->lines.items[row].begin <= 1) {
+    while (row > 0 && editor_line_len(e, row) <= 1) {
         row -= 1;
     }
-    while (row > 0 && e->lines.items[row].end - e->lines.items[row].begin > 1) {
+    while (row > 0 && editor_line_len(e, row) > 1) {
         row -= 1;
     }
-    e->cursor = e->lines.items[row].begin;
+    e->cursor = line_index_line(&e->lines, row).begin;
 }
 
 void editor_move_paragraph_down(Editor *e)
 {
     editor_stop_search(e);
     size_t row = editor_cursor_row(e);
-    while (row + 1 < e->lines.count && e->lines.items[row].end - e->lines.items[row].begin <= 1) {
+    size_t lines_count = line_index_count(&e->lines);
+    while (row + 1 < lines_count && editor_line_len(e, row) <= 1) {
         row += 1;
     }
-    while (row + 1 < e->lines.count && e->lines.items[row].end - e->lines.items[row].begin > 1) {
+    while (row + 1 < lines_count && editor_line_len(e, row) > 1) {
         row += 1;
     }
-    e->cursor = e->lines.items[row].begin;
+    e->cursor = line_index_line(&e->lines, row).begin;
 }
@@ -3,35 +3,43 @@
 
 #include <stdlib.h>
 #include "common.h"
+#include "arena.h"
+#include "piece_table.h"
+#include "line_index.h"
 #include "free_glyph.h"
 #include "simple_renderer.h"
 #include "lexer.h"
+#include "line_slot.h"
 
 #include <SDL2/SDL.h>
 
+// Everything the layer of the editor depends on, see editor_render()
 typedef struct {
-    size_t begin;
-    size_t end;
-} Line;
-
-typedef struct {
-    Line *items;
-    size_t count;
-    size_t capacity;
-} Lines;
-
-typedef struct {
-    Token *items;
-    size_t count;
-    size_t capacity;
-} Tokens;
+    Vec2f resolution;
+    Vec2f camera_pos;
+    float camera_scale;
+    uint64_t versions; // Line_Index.versions
+    bool selection;
+    size_t select_begin;
+    size_t cursor;
+    bool searching;
+    float search_width;
+} Editor_Layer_Key;
 
 typedef struct {
     Free_Glyph_Atlas *atlas;
 
-    String_Builder data;
-    Lines lines;
+    Piece_Table data;
+    Line_Index lines;
+    // Scratch space for lexing a single line. The tokens are cached in the line index.
     Tokens tokens;
+    // Copy of the lexed line if it crosses piece boundaries
+    Arena tokens_arena;
+    Arena render_arena;
+    Line_Slot line_slots[SIMPLE_CACHE_SLOTS];
+    bool layer_valid;
+    Editor_Layer_Key layer_key;
+    float layer_max_line_len;
     String_Builder file_path;
 
     bool searching;
@@ -70,9 +78,16 @@ void editor_move_paragraph_up(Editor *e);
 void editor_move_paragraph_down(Editor *e);
 
 void editor_insert_char(Editor *e, char x);
-void editor_insert_buf(Editor *e, char *buf, size_t buf_len);
+void editor_insert_buf(Editor *e, const char *buf, size_t buf_len);
 void editor_retokenize(Editor *e);
 void editor_render(SDL_Window *window, Free_Glyph_Atlas *atlas, Simple_Renderer *sr, Editor *editor);
+
+// The cursor stays visible for CURSOR_BLINK_THRESHOLD ms after the last stroke and then blinks
+#define CURSOR_BLINK_THRESHOLD 500
+#define CURSOR_BLINK_PERIOD 1000
+bool editor_cursor_visible(const Editor *e, Uint32 now);
+// Milliseconds until the cursor appears or disappears
+Uint32 editor_cursor_next_blink(const Editor *e, Uint32 now);
 void editor_update_selection(Editor *e, bool shift);
 void editor_clipboard_copy(Editor *e);
 void editor_clipboard_paste(Editor *e);
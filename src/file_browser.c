@@ -151,7 +151,6 @@ void fb_render(const File_Browser *fb, SDL_Window *window, Free_Glyph_Atlas *atl
             &end);
         simple_renderer_solid_rect(sr, begin, vec2f(end.x - begin.x, FREE_GLYPH_FONT_SIZE), vec4f(.25, .25, .25, 1));
     }
-    simple_renderer_flush(sr);
 
     simple_renderer_set_shader(sr, SHADER_FOR_EPICNESS);
     for (size_t row = 0; row < fb->files.count; ++row) {
@@ -194,8 +193,15 @@ void fb_render(const File_Browser *fb, SDL_Window *window, Free_Glyph_Atlas *atl
                              vec2fs(2.0f));
         sr->camera_scale_vel = (target_scale - sr->camera_scale) * 2.0f;
 
-        sr->camera_pos = vec2f_add(sr->camera_pos, vec2f_mul(sr->camera_vel, vec2fs(DELTA_TIME)));
-        sr->camera_scale = sr->camera_scale + sr->camera_scale_vel * DELTA_TIME;
+        if (simple_renderer_camera_settled(sr)) {
+            sr->camera_pos = target;
+            sr->camera_scale = target_scale;
+            sr->camera_vel = vec2fs(0.0f);
+            sr->camera_scale_vel = 0.0f;
+        } else {
+            sr->camera_pos = vec2f_add(sr->camera_pos, vec2f_mul(sr->camera_vel, vec2fs(DELTA_TIME)));
+            sr->camera_scale = sr->camera_scale + sr->camera_scale_vel * DELTA_TIME;
+        }
     }
 }
 
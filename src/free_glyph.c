@@ -1,23 +1,458 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <SDL2/SDL.h>
+#include "./common.h"
 #include "./free_glyph.h"
+#include "./utf8.h"
 
-void free_glyph_atlas_init(Free_Glyph_Atlas *atlas, FT_Face face)
+#define FREE_GLYPH_LOAD_FLAGS (FT_LOAD_RENDER | FT_LOAD_TARGET_(FT_RENDER_MODE_SDF))
+#define FREE_GLYPH_ATLAS_WIDTH (FREE_GLYPH_CELLS_PER_ROW*FREE_GLYPH_CELL_SIZE)
+#define FREE_GLYPH_CELLS_HEIGHT (FREE_GLYPH_CELLS/FREE_GLYPH_CELLS_PER_ROW*FREE_GLYPH_CELL_SIZE)
+#define FREE_GLYPH_PADDING 2
+// Opening a face per thread costs a few milliseconds, beyond that the threads do not pay off for
+// the 96 ASCII glyphs
+#define FREE_GLYPH_MAX_JOBS 16
+
+static void free_glyph_atlas_upload_metric(Free_Glyph_Atlas *atlas, size_t slot, float metric[2][4])
+{
+    glActiveTexture(GL_TEXTURE0 + SIMPLE_GLYPH_METRICS_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, atlas->metrics_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint) slot, 0, 1, 1, GL_RGBA, GL_FLOAT, metric[0]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint) slot, 1, 1, 1, GL_RGBA, GL_FLOAT, metric[1]);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// The metrics for the vertex shader that expands the glyph instances into quads
+static void free_glyph_atlas_metric(const Free_Glyph_Atlas *atlas, size_t slot, float metric[2][4])
+{
+    Glyph_Metric m = atlas->metrics[slot];
+    metric[0][0] = m.bl;
+    metric[0][1] = m.bt;
+    metric[0][2] = m.bw;
+    metric[0][3] = m.bh;
+    metric[1][0] = m.tx;
+    metric[1][1] = m.tx + m.bw / (float) atlas->atlas_width;
+    metric[1][2] = m.ty;
+    metric[1][3] = m.ty + m.bh / (float) atlas->atlas_height;
+}
+
+// The ASCII region together with its metrics is cached on disk, so the following launches skip
+// rasterizing it. The file is the header followed by the font path, metrics[GLYPH_METRICS_CAPACITY]
+// and atlas_width*ascii_height bytes of the ASCII region.
+#define FREE_GLYPH_CACHE_MAGIC "dedatlas"
+// NOTE: bump it whenever the rasterization or the layout of the file changes
+#define FREE_GLYPH_CACHE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pixel_size;
+    int64_t font_mtime;
+    uint64_t font_size;
+    uint32_t font_path_len;
+    uint32_t metric_size; // sizeof(Glyph_Metric)
+    uint32_t atlas_width;
+    uint32_t ascii_height;
+} Free_Glyph_Cache_Header;
+
+// $XDG_CACHE_HOME/ded/atlas-<hash of the font path>-<pixel size>.bin
+static bool free_glyph_cache_path(String_Builder *sb, const char *font_file_path, uint32_t pixel_size)
+{
+    const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg_cache_home != NULL && *xdg_cache_home != '\0') {
+        sb_append_cstr(sb, xdg_cache_home);
+    } else if (home != NULL && *home != '\0') {
+        sb_append_cstr(sb, home);
+        sb_append_cstr(sb, "/.cache");
+    } else {
+        return false;
+    }
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (const char *c = font_file_path; *c != '\0'; ++c) {
+        hash = (hash ^ (unsigned char) *c)*1099511628211ull;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "/ded/atlas-%016llx-%u.bin", (unsigned long long) hash, pixel_size);
+    sb_append_cstr(sb, name);
+    sb_append_null(sb);
+    return true;
+}
+
+static bool free_glyph_atlas_load_cache(Free_Glyph_Atlas *atlas, const char *cache_path, const Free_Glyph_Cache_Header *key, const char *font_file_path, Mapped_File *mf)
+{
+    if (map_entire_file(cache_path, mf) != 0) return false;
+
+    Free_Glyph_Cache_Header header;
+    if (mf->size < sizeof(header)) return false;
+    memcpy(&header, mf->data, sizeof(header));
+    if (memcmp(header.magic, key->magic, sizeof(header.magic)) != 0 ||
+        header.version != key->version ||
+        header.pixel_size != key->pixel_size ||
+        header.font_mtime != key->font_mtime ||
+        header.font_size != key->font_size ||
+        header.font_path_len != key->font_path_len ||
+        header.metric_size != key->metric_size ||
+        header.atlas_width != FREE_GLYPH_ATLAS_WIDTH) {
+        return false;
+    }
+
+    const char *data = (const char *) mf->data + sizeof(header);
+    size_t metrics_size = GLYPH_METRICS_CAPACITY*sizeof(Glyph_Metric);
+    size_t pixels_size = (size_t) header.atlas_width*header.ascii_height;
+    if (mf->size != sizeof(header) + header.font_path_len + metrics_size + pixels_size) return false;
+    if (memcmp(data, font_file_path, header.font_path_len) != 0) return false;
+    data += header.font_path_len;
+
+    atlas->atlas_width = header.atlas_width;
+    atlas->ascii_height = header.ascii_height;
+    memcpy(atlas->metrics, data, metrics_size);
+    return true;
+}
+
+static void free_glyph_atlas_save_cache(const Free_Glyph_Atlas *atlas, const char *cache_path, Free_Glyph_Cache_Header header, const char *font_file_path, const char *pixels)
+{
+    header.atlas_width = atlas->atlas_width;
+    header.ascii_height = atlas->ascii_height;
+
+    String_Builder sb = {0};
+    sb_append_buf(&sb, (const char *) &header, sizeof(header));
+    sb_append_buf(&sb, font_file_path, header.font_path_len);
+    sb_append_buf(&sb, (const char *) atlas->metrics, GLYPH_METRICS_CAPACITY*sizeof(Glyph_Metric));
+    sb_append_buf(&sb, pixels, (size_t) atlas->atlas_width*atlas->ascii_height);
+
+    // The directories of the cache are created on demand
+    String_Builder dir_path = {0};
+    for (const char *c = cache_path; *c != '\0'; ++c) {
+        if (*c == '/' && c != cache_path) {
+            dir_path.count = 0;
+            size_t dir_path_len = (size_t) (c - cache_path);
+            sb_append_buf(&dir_path, cache_path, dir_path_len);
+            sb_append_null(&dir_path);
+            make_dir(dir_path.items);
+        }
+    }
+    free(dir_path.items);
+
+    // NOTE: written aside and renamed, so a concurrently starting instance never maps a half written file
+    String_Builder tmp_path = {0};
+    sb_append_cstr(&tmp_path, cache_path);
+    sb_append_cstr(&tmp_path, ".tmp");
+    sb_append_null(&tmp_path);
+
+    Errno err = write_entire_file(tmp_path.items, sb.items, sb.count);
+    if (err == 0 && rename(tmp_path.items, cache_path) < 0) err = errno;
+    if (err != 0) {
+        fprintf(stderr, "WARNING: could not save the glyph atlas cache %s: %s\n", cache_path, strerror(err));
+        remove(tmp_path.items);
+    }
+
+    free(tmp_path.items);
+    free(sb.items);
+}
+
+// Bottom-left skyline packer. The skyline is the outline of the top edges of the packed rectangles
+// as the segments going left to right without gaps. Every rectangle is put where its top edge ends
+// up the lowest, leftmost on a tie.
+typedef struct {
+    size_t x;
+    size_t y;
+    size_t width;
+} Free_Glyph_Skyline_Segment;
+
+typedef struct {
+    // Every rectangle splits at most one segment in two, so there are never more segments than
+    // rectangles plus one
+    Free_Glyph_Skyline_Segment segments[GLYPH_METRICS_CAPACITY + 1];
+    size_t count;
+} Free_Glyph_Skyline;
+
+// The y of the rectangle of the width w put at the beginning of the segment i, or false if it does
+// not fit the width of the skyline
+static bool free_glyph_skyline_fit(const Free_Glyph_Skyline *skyline, size_t i, size_t w, size_t *y)
+{
+    size_t x = skyline->segments[i].x;
+    if (x + w > FREE_GLYPH_ATLAS_WIDTH) return false;
+    *y = 0;
+    for (size_t left = w; left > 0; ++i) {
+        assert(i < skyline->count);
+        if (*y < skyline->segments[i].y) *y = skyline->segments[i].y;
+        if (skyline->segments[i].width >= left) break;
+        left -= skyline->segments[i].width;
+    }
+    return true;
+}
+
+static void free_glyph_skyline_add(Free_Glyph_Skyline *skyline, size_t w, size_t h, size_t *x, size_t *y)
+{
+    assert(w <= FREE_GLYPH_ATLAS_WIDTH);
+    size_t best = skyline->count;
+    size_t best_y = 0;
+    for (size_t i = 0; i < skyline->count; ++i) {
+        size_t fit_y;
+        if (free_glyph_skyline_fit(skyline, i, w, &fit_y) && (best == skyline->count || fit_y < best_y)) {
+            best = i;
+            best_y = fit_y;
+        }
+    }
+    assert(best < skyline->count);
+    *x = skyline->segments[best].x;
+    *y = best_y;
+
+    // The new segment replaces the ones it covers, the last one covered partially is cut
+    Free_Glyph_Skyline_Segment segment = {*x, best_y + h, w};
+    size_t end = best;
+    while (end < skyline->count && skyline->segments[end].x + skyline->segments[end].width <= *x + w) {
+        end += 1;
+    }
+    if (end < skyline->count && skyline->segments[end].x < *x + w) {
+        size_t cut = *x + w - skyline->segments[end].x;
+        skyline->segments[end].x += cut;
+        skyline->segments[end].width -= cut;
+    }
+    // segments[best..end) are replaced by the single new one
+    size_t tail = skyline->count - end;
+    memmove(&skyline->segments[best + 1], &skyline->segments[end], tail*sizeof(segment));
+    skyline->segments[best] = segment;
+    skyline->count = best + 1 + tail;
+    assert(skyline->count <= sizeof(skyline->segments)/sizeof(skyline->segments[0]));
+
+    // The neighbours of the same height are merged back together
+    for (size_t i = 0; i + 1 < skyline->count;) {
+        if (skyline->segments[i].y == skyline->segments[i + 1].y) {
+            skyline->segments[i].width += skyline->segments[i + 1].width;
+            memmove(&skyline->segments[i + 1], &skyline->segments[i + 2], (skyline->count - i - 2)*sizeof(segment));
+            skyline->count -= 1;
+        } else {
+            i += 1;
+        }
+    }
+}
+
+// The glyphs first, first + step, ... below GLYPH_METRICS_CAPACITY. FreeType faces must not be
+// shared between the threads, so the workers open their own library and face of the font.
+typedef struct {
+    FT_Face face; // NULL if the job opens its own
+    const char *font_file_path;
+    FT_UInt pixel_size;
+    int first;
+    int step;
+
+    Glyph_Metric metrics[GLYPH_METRICS_CAPACITY];
+    size_t offsets[GLYPH_METRICS_CAPACITY]; // of the bitmaps, which are stored row by row without padding
+    String_Builder bitmaps;
+} Free_Glyph_Job;
+
+static int free_glyph_job(void *data)
 {
-    // TODO: Introduction of SDF font slowed down the start up time
-    // We need to investigate what's up with that
-    FT_Int32 load_flags = FT_LOAD_RENDER | FT_LOAD_TARGET_(FT_RENDER_MODE_SDF);
-    for (int i = 32; i < 128; ++i) {
-        if (FT_Load_Char(face, i, load_flags)) {
+    Free_Glyph_Job *job = data;
+    FT_Library library = NULL;
+    FT_Face face = job->face;
+    if (face == NULL) {
+        if (FT_Init_FreeType(&library) ||
+            FT_New_Face(library, job->font_file_path, 0, &face) ||
+            FT_Set_Pixel_Sizes(face, 0, job->pixel_size)) {
+            fprintf(stderr, "ERROR: could not open font %s on a rasterization thread\n", job->font_file_path);
+            exit(1);
+        }
+    }
+
+    for (int i = job->first; i < GLYPH_METRICS_CAPACITY; i += job->step) {
+        if (FT_Load_Char(face, i, FREE_GLYPH_LOAD_FLAGS)) {
             fprintf(stderr, "ERROR: could not load glyph of a character with code %d\n", i);
             exit(1);
         }
 
-        atlas->atlas_width += face->glyph->bitmap.width;
-        if (atlas->atlas_height < face->glyph->bitmap.rows) {
-            atlas->atlas_height = face->glyph->bitmap.rows;
+        const FT_Bitmap *bitmap = &face->glyph->bitmap;
+        job->metrics[i].ax = face->glyph->advance.x >> 6;
+        job->metrics[i].ay = face->glyph->advance.y >> 6;
+        job->metrics[i].bw = bitmap->width;
+        job->metrics[i].bh = bitmap->rows;
+        job->metrics[i].bl = face->glyph->bitmap_left;
+        job->metrics[i].bt = face->glyph->bitmap_top;
+
+        job->offsets[i] = job->bitmaps.count;
+        for (unsigned int row = 0; row < bitmap->rows; ++row) {
+            sb_append_buf(&job->bitmaps, (const char *) bitmap->buffer + row*bitmap->pitch, bitmap->width);
+        }
+    }
+
+    // NOTE: FT_Done_FreeType() releases the faces of the library too
+    if (library != NULL) FT_Done_FreeType(library);
+    return 0;
+}
+
+// Every glyph is rendered once and kept aside until all of them are packed. Then they are copied
+// into the CPU staging bitmap of the ASCII region.
+static char *free_glyph_atlas_rasterize_ascii(Free_Glyph_Atlas *atlas, const char *font_file_path)
+{
+    const int glyphs_count = GLYPH_METRICS_CAPACITY - 32;
+    int cpus = SDL_GetCPUCount();
+    size_t jobs_count = cpus > 1 ? (size_t) cpus : 1;
+    if (jobs_count > FREE_GLYPH_MAX_JOBS) jobs_count = FREE_GLYPH_MAX_JOBS;
+    // DED_RASTER_JOBS overrides it, e.g. DED_RASTER_JOBS=1 to compare with the sequential rasterization
+    const char *raster_jobs = getenv("DED_RASTER_JOBS");
+    if (raster_jobs != NULL && atoi(raster_jobs) > 0) {
+        jobs_count = (size_t) atoi(raster_jobs);
+        if (jobs_count > (size_t) glyphs_count) jobs_count = (size_t) glyphs_count;
+    }
+
+    Free_Glyph_Job *jobs = calloc(jobs_count, sizeof(*jobs));
+    SDL_Thread **threads = calloc(jobs_count, sizeof(*threads));
+    assert(jobs != NULL && threads != NULL && "Buy more RAM lol");
+
+    // The glyphs are interleaved between the jobs, so the wide and narrow ones are spread evenly
+    for (size_t i = 0; i < jobs_count; ++i) {
+        jobs[i].face = i == 0 ? atlas->face : NULL;
+        jobs[i].font_file_path = font_file_path;
+        jobs[i].pixel_size = atlas->face->size->metrics.y_ppem;
+        jobs[i].first = 32 + (int) i;
+        jobs[i].step = (int) jobs_count;
+    }
+
+    Uint64 begin = SDL_GetPerformanceCounter();
+    // The first job is run on the current thread with the face of the atlas. If a thread could not
+    // be created its job is run on the current thread too.
+    for (size_t i = 1; i < jobs_count; ++i) {
+        threads[i] = SDL_CreateThread(free_glyph_job, "free_glyph", &jobs[i]);
+    }
+    free_glyph_job(&jobs[0]);
+    for (size_t i = 1; i < jobs_count; ++i) {
+        if (threads[i] != NULL) {
+            SDL_WaitThread(threads[i], NULL);
+        } else {
+            free_glyph_job(&jobs[i]);
+        }
+    }
+    double secs = (double) (SDL_GetPerformanceCounter() - begin) / (double) SDL_GetPerformanceFrequency();
+    if (getenv("DED_STARTUP_STATS") != NULL) {
+        printf("Rasterized %d glyphs in %.3f s on %zu threads\n", glyphs_count, secs, jobs_count);
+    }
+
+    for (int i = 32; i < GLYPH_METRICS_CAPACITY; ++i) {
+        atlas->metrics[i] = jobs[(size_t) (i - 32) % jobs_count].metrics[i];
+    }
+
+    // The ASCII region is as wide as the grid of the cells below it. The tallest glyphs go first,
+    // which keeps the skyline flat.
+    atlas->atlas_width = FREE_GLYPH_ATLAS_WIDTH;
+    int order[GLYPH_METRICS_CAPACITY - 32];
+    for (int i = 32; i < GLYPH_METRICS_CAPACITY; ++i) {
+        int j = i - 32;
+        while (j > 0 && atlas->metrics[order[j - 1]].bh < atlas->metrics[i].bh) {
+            order[j] = order[j - 1];
+            j -= 1;
+        }
+        order[j] = i;
+    }
+
+    Free_Glyph_Skyline skyline = {0};
+    skyline.segments[skyline.count++] = (Free_Glyph_Skyline_Segment) {0, 0, FREE_GLYPH_ATLAS_WIDTH};
+    size_t xs[GLYPH_METRICS_CAPACITY] = {0};
+    size_t ys[GLYPH_METRICS_CAPACITY] = {0};
+    for (size_t k = 0; k < sizeof(order)/sizeof(order[0]); ++k) {
+        int i = order[k];
+        size_t bw = (size_t) atlas->metrics[i].bw;
+        size_t bh = (size_t) atlas->metrics[i].bh;
+        if (bw == 0 || bh == 0) continue;
+        // NOTE: the padding keeps the linear filtering from bleeding the neighbours into the glyph
+        free_glyph_skyline_add(&skyline, bw + FREE_GLYPH_PADDING, bh + FREE_GLYPH_PADDING, &xs[i], &ys[i]);
+        if (atlas->ascii_height < ys[i] + bh + FREE_GLYPH_PADDING) {
+            atlas->ascii_height = (FT_UInt) (ys[i] + bh + FREE_GLYPH_PADDING);
+        }
+    }
+    atlas->atlas_height = atlas->ascii_height + FREE_GLYPH_CELLS_HEIGHT;
+
+    char *pixels = calloc((size_t) atlas->atlas_width*atlas->ascii_height, 1);
+    assert(pixels != NULL && "Buy more RAM lol");
+    for (int i = 32; i < GLYPH_METRICS_CAPACITY; ++i) {
+        const Free_Glyph_Job *job = &jobs[(size_t) (i - 32) % jobs_count];
+        size_t bw = (size_t) atlas->metrics[i].bw;
+        size_t bh = (size_t) atlas->metrics[i].bh;
+        for (size_t row = 0; row < bh; ++row) {
+            memcpy(pixels + (ys[i] + row)*atlas->atlas_width + xs[i], job->bitmaps.items + job->offsets[i] + row*bw, bw);
+        }
+        atlas->metrics[i].tx = (float) xs[i] / (float) atlas->atlas_width;
+        atlas->metrics[i].ty = (float) ys[i] / (float) atlas->atlas_height;
+    }
+
+    for (size_t i = 0; i < jobs_count; ++i) {
+        free(jobs[i].bitmaps.items);
+    }
+    free(threads);
+    free(jobs);
+    return pixels;
+}
+
+// The texture memory taken by the atlas and the area of the ASCII region wasted on the padding and
+// the gaps left by the packer. Printed along with the other DED_STARTUP_STATS.
+static void free_glyph_atlas_report(const Free_Glyph_Atlas *atlas)
+{
+    if (getenv("DED_STARTUP_STATS") == NULL) return;
+
+    size_t glyphs_area = 0;
+    for (size_t i = 32; i < GLYPH_METRICS_CAPACITY; ++i) {
+        glyphs_area += (size_t) atlas->metrics[i].bw*(size_t) atlas->metrics[i].bh;
+    }
+    size_t region_area = (size_t) atlas->atlas_width*atlas->ascii_height;
+    size_t glyphs_bytes = (size_t) atlas->atlas_width*atlas->atlas_height; // GL_RED
+    size_t metrics_bytes = FREE_GLYPH_SLOTS*2*4*sizeof(float);             // GL_RGBA32F
+    printf("Glyph atlas: %ux%u, %.2f MB of glyphs and %.2f KB of metrics\n",
+           atlas->atlas_width, atlas->atlas_height, (double) glyphs_bytes / 1e6, (double) metrics_bytes / 1e3);
+    printf("    ASCII region: %ux%u, %.1f%% of it is wasted\n",
+           atlas->atlas_width, atlas->ascii_height,
+           region_area > 0 ? 100.0*(double) (region_area - glyphs_area) / (double) region_area : 0.0);
+}
+
+void free_glyph_atlas_init(Free_Glyph_Atlas *atlas, FT_Face face, const char *font_file_path)
+{
+    atlas->face = face;
+
+    Free_Glyph_Cache_Header key = {
+        .magic = FREE_GLYPH_CACHE_MAGIC,
+        .version = FREE_GLYPH_CACHE_VERSION,
+        .pixel_size = face->size->metrics.y_ppem,
+        .font_path_len = (uint32_t) strlen(font_file_path),
+        .metric_size = sizeof(Glyph_Metric),
+    };
+    File_Stamp stamp;
+    String_Builder cache_path = {0};
+    bool cacheable = getenv("DED_NO_ATLAS_CACHE") == NULL &&
+                     stamp_of_file(font_file_path, &stamp) == 0 &&
+                     free_glyph_cache_path(&cache_path, font_file_path, key.pixel_size);
+    if (cacheable) {
+        key.font_mtime = stamp.mtime;
+        key.font_size = stamp.size;
+    }
+
+    Mapped_File mf = {0};
+    const char *pixels = NULL;
+    char *rasterized = NULL;
+    if (cacheable && free_glyph_atlas_load_cache(atlas, cache_path.items, &key, font_file_path, &mf)) {
+        pixels = (const char *) mf.data + mf.size - (size_t) atlas->atlas_width*atlas->ascii_height;
+    } else {
+        atlas->atlas_width = 0;
+        atlas->ascii_height = 0;
+        rasterized = free_glyph_atlas_rasterize_ascii(atlas, font_file_path);
+        pixels = rasterized;
+        if (cacheable) {
+            free_glyph_atlas_save_cache(atlas, cache_path.items, key, font_file_path, pixels);
         }
     }
+    atlas->atlas_height = atlas->ascii_height + FREE_GLYPH_CELLS_HEIGHT;
+    free_glyph_atlas_report(atlas);
+
+    GLint max_texture_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    if (atlas->atlas_width > (FT_UInt) max_texture_size || atlas->atlas_height > (FT_UInt) max_texture_size) {
+        fprintf(stderr, "ERROR: the glyph atlas %ux%u exceeds GL_MAX_TEXTURE_SIZE %d\n",
+                atlas->atlas_width, atlas->atlas_height, max_texture_size);
+        exit(1);
+    }
 
     glActiveTexture(GL_TEXTURE0);
     glGenTextures(1, &atlas->glyphs_texture);
@@ -39,57 +474,245 @@ void free_glyph_atlas_init(Free_Glyph_Atlas *atlas, FT_Face face)
         GL_RED,
         GL_UNSIGNED_BYTE,
         NULL);
+    glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        0,
+        0,
+        (GLsizei) atlas->atlas_width,
+        (GLsizei) atlas->ascii_height,
+        GL_RED,
+        GL_UNSIGNED_BYTE,
+        pixels);
 
-    int x = 0;
-    for (int i = 32; i < 128; ++i) {
-        if (FT_Load_Char(face, i, load_flags)) {
-            fprintf(stderr, "ERROR: could not load glyph of a character with code %d\n", i);
-            exit(1);
-        }
+    unmap_entire_file(&mf);
+    free(rasterized);
+    free(cache_path.items);
 
-        if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL)) {
-            fprintf(stderr, "ERROR: could not render glyph of a character with code %d\n", i);
-            exit(1);
-        }
+    static float metrics[2][FREE_GLYPH_SLOTS][4] = {0};
+    for (size_t i = 0; i < GLYPH_METRICS_CAPACITY; ++i) {
+        float metric[2][4];
+        free_glyph_atlas_metric(atlas, i, metric);
+        memcpy(metrics[0][i], metric[0], sizeof(metric[0]));
+        memcpy(metrics[1][i], metric[1], sizeof(metric[1]));
+    }
+
+    glActiveTexture(GL_TEXTURE0 + SIMPLE_GLYPH_METRICS_TEXTURE_UNIT);
+    glGenTextures(1, &atlas->metrics_texture);
+    glBindTexture(GL_TEXTURE_2D, atlas->metrics_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGBA32F,
+        FREE_GLYPH_SLOTS,
+        2,
+        0,
+        GL_RGBA,
+        GL_FLOAT,
+        metrics);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void free_glyph_atlas_begin_frame(Free_Glyph_Atlas *atlas)
+{
+    atlas->frame += 1;
+}
 
-        atlas->metrics[i].ax = face->glyph->advance.x >> 6;
-        atlas->metrics[i].ay = face->glyph->advance.y >> 6;
-        atlas->metrics[i].bw = face->glyph->bitmap.width;
-        atlas->metrics[i].bh = face->glyph->bitmap.rows;
-        atlas->metrics[i].bl = face->glyph->bitmap_left;
-        atlas->metrics[i].bt = face->glyph->bitmap_top;
-        atlas->metrics[i].tx = (float) x / (float) atlas->atlas_width;
+static size_t free_glyph_codepoint_hash(uint32_t codepoint)
+{
+    return (codepoint*0x9E3779B9u) & (FREE_GLYPH_CODEPOINTS_CAPACITY - 1);
+}
 
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTexSubImage2D(
-            GL_TEXTURE_2D,
-            0,
-            x,
-            0,
-            face->glyph->bitmap.width,
-            face->glyph->bitmap.rows,
-            GL_RED,
-            GL_UNSIGNED_BYTE,
-            face->glyph->bitmap.buffer);
-        x += face->glyph->bitmap.width;
+static Free_Glyph_Codepoint *free_glyph_atlas_find(Free_Glyph_Atlas *atlas, uint32_t codepoint)
+{
+    size_t i = free_glyph_codepoint_hash(codepoint);
+    while (atlas->codepoints[i].occupied) {
+        if (atlas->codepoints[i].codepoint == codepoint) return &atlas->codepoints[i];
+        i = (i + 1) & (FREE_GLYPH_CODEPOINTS_CAPACITY - 1);
     }
+    return &atlas->codepoints[i];
 }
 
-float free_glyph_atlas_cursor_pos(const Free_Glyph_Atlas *atlas, const char *text, size_t text_size, Vec2f pos, size_t col)
+// Backward shift deletion, so the probe sequences stay intact without tombstones
+static void free_glyph_atlas_forget(Free_Glyph_Atlas *atlas, uint32_t codepoint)
 {
-    for (size_t i = 0; i < text_size; ++i) {
-        if (i == col) {
-            return pos.x;
+    Free_Glyph_Codepoint *entry = free_glyph_atlas_find(atlas, codepoint);
+    assert(entry->occupied);
+    size_t hole = entry - atlas->codepoints;
+    size_t i = hole;
+    for (;;) {
+        i = (i + 1) & (FREE_GLYPH_CODEPOINTS_CAPACITY - 1);
+        if (!atlas->codepoints[i].occupied) break;
+        size_t home = free_glyph_codepoint_hash(atlas->codepoints[i].codepoint);
+        // Can the entry at i be moved into the hole without ending up before its home?
+        if (((i - home) & (FREE_GLYPH_CODEPOINTS_CAPACITY - 1)) >= ((i - hole) & (FREE_GLYPH_CODEPOINTS_CAPACITY - 1))) {
+            atlas->codepoints[hole] = atlas->codepoints[i];
+            hole = i;
         }
+    }
+    atlas->codepoints[hole].occupied = false;
+}
+
+// The least recently used cell that is not used within the current frame
+static bool free_glyph_atlas_evict(Free_Glyph_Atlas *atlas, size_t *cell)
+{
+    bool found = false;
+    for (size_t i = 0; i < FREE_GLYPH_CELLS; ++i) {
+        const Free_Glyph_Cell *c = &atlas->cells[i];
+        if (!c->occupied) {
+            *cell = i;
+            return true;
+        }
+        if (c->last_used < atlas->frame && (!found || c->last_used < atlas->cells[*cell].last_used)) {
+            *cell = i;
+            found = true;
+        }
+    }
+    if (found) {
+        free_glyph_atlas_forget(atlas, atlas->cells[*cell].codepoint);
+        atlas->cells[*cell].occupied = false;
+    }
+    return found;
+}
 
-        size_t glyph_index = text[i];
-        if (glyph_index >= GLYPH_METRICS_CAPACITY) {
-            glyph_index = '?';
+static void free_glyph_atlas_remember_missing(Free_Glyph_Atlas *atlas, uint32_t codepoint)
+{
+    if (atlas->missing_count >= FREE_GLYPH_MISSING_CAPACITY) {
+        // The map is rebuilt out of the cells, which drops all the missing codepoints at once
+        memset(atlas->codepoints, 0, sizeof(atlas->codepoints));
+        for (size_t i = 0; i < FREE_GLYPH_CELLS; ++i) {
+            if (!atlas->cells[i].occupied) continue;
+            Free_Glyph_Codepoint *entry = free_glyph_atlas_find(atlas, atlas->cells[i].codepoint);
+            entry->occupied = true;
+            entry->codepoint = atlas->cells[i].codepoint;
+            entry->cell = (uint16_t) i;
         }
+        atlas->missing_count = 0;
+    }
+
+    Free_Glyph_Codepoint *entry = free_glyph_atlas_find(atlas, codepoint);
+    assert(!entry->occupied);
+    entry->occupied = true;
+    entry->missing = true;
+    entry->codepoint = codepoint;
+    atlas->missing_count += 1;
+}
+
+static bool free_glyph_atlas_rasterize(Free_Glyph_Atlas *atlas, FT_UInt index, size_t cell)
+{
+    FT_Face face = atlas->face;
+    if (FT_Load_Glyph(face, index, FREE_GLYPH_LOAD_FLAGS)) return false;
+    if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL)) return false;
+
+    // NOTE: the glyphs bigger than the cell are cropped
+    FT_Bitmap *bitmap = &face->glyph->bitmap;
+    unsigned int width = bitmap->width < FREE_GLYPH_CELL_SIZE ? bitmap->width : FREE_GLYPH_CELL_SIZE;
+    unsigned int rows = bitmap->rows < FREE_GLYPH_CELL_SIZE ? bitmap->rows : FREE_GLYPH_CELL_SIZE;
+
+    // The whole cell is uploaded, so nothing of the evicted glyph bleeds into the new one
+    static unsigned char pixels[FREE_GLYPH_CELL_SIZE*FREE_GLYPH_CELL_SIZE];
+    memset(pixels, 0, sizeof(pixels));
+    for (unsigned int row = 0; row < rows; ++row) {
+        memcpy(&pixels[row*FREE_GLYPH_CELL_SIZE], bitmap->buffer + row*bitmap->pitch, width);
+    }
+
+    size_t x = cell%FREE_GLYPH_CELLS_PER_ROW*FREE_GLYPH_CELL_SIZE;
+    size_t y = atlas->ascii_height + cell/FREE_GLYPH_CELLS_PER_ROW*FREE_GLYPH_CELL_SIZE;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas->glyphs_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        (GLint) x,
+        (GLint) y,
+        FREE_GLYPH_CELL_SIZE,
+        FREE_GLYPH_CELL_SIZE,
+        GL_RED,
+        GL_UNSIGNED_BYTE,
+        pixels);
+
+    size_t slot = GLYPH_METRICS_CAPACITY + cell;
+    atlas->metrics[slot].ax = face->glyph->advance.x >> 6;
+    atlas->metrics[slot].ay = face->glyph->advance.y >> 6;
+    atlas->metrics[slot].bw = width;
+    atlas->metrics[slot].bh = rows;
+    atlas->metrics[slot].bl = face->glyph->bitmap_left;
+    atlas->metrics[slot].bt = face->glyph->bitmap_top;
+    atlas->metrics[slot].tx = (float) x / (float) atlas->atlas_width;
+    atlas->metrics[slot].ty = (float) y / (float) atlas->atlas_height;
+
+    float metric[2][4];
+    free_glyph_atlas_metric(atlas, slot, metric);
+    free_glyph_atlas_upload_metric(atlas, slot, metric);
+    return true;
+}
 
-        Glyph_Metric metric = atlas->metrics[glyph_index];
-        pos.x += metric.ax;
-        pos.y += metric.ay;
+uint16_t free_glyph_atlas_glyph(Free_Glyph_Atlas *atlas, uint32_t codepoint)
+{
+    if (codepoint < GLYPH_METRICS_CAPACITY) return (uint16_t) codepoint;
+
+    Free_Glyph_Codepoint *entry = free_glyph_atlas_find(atlas, codepoint);
+    if (entry->occupied) {
+        if (entry->missing) return '?';
+        atlas->cells[entry->cell].last_used = atlas->frame;
+        return GLYPH_METRICS_CAPACITY + entry->cell;
+    }
+
+    // NOTE: checked before evicting anything, so the missing glyphs never push the live ones out
+    FT_UInt index = FT_Get_Char_Index(atlas->face, codepoint);
+    if (index == 0) {
+        free_glyph_atlas_remember_missing(atlas, codepoint);
+        return '?';
+    }
+
+    // All the cells are used within this frame. It is tried again in the next one.
+    size_t cell;
+    if (!free_glyph_atlas_evict(atlas, &cell)) return '?';
+    if (!free_glyph_atlas_rasterize(atlas, index, cell)) {
+        free_glyph_atlas_remember_missing(atlas, codepoint);
+        return '?';
+    }
+
+    // NOTE: the eviction could have shifted the entries around
+    entry = free_glyph_atlas_find(atlas, codepoint);
+    assert(!entry->occupied);
+    entry->occupied = true;
+    entry->missing = false;
+    entry->codepoint = codepoint;
+    entry->cell = (uint16_t) cell;
+    atlas->cells[cell].occupied = true;
+    atlas->cells[cell].codepoint = codepoint;
+    atlas->cells[cell].last_used = atlas->frame;
+    return GLYPH_METRICS_CAPACITY + cell;
+}
+
+size_t free_glyph_atlas_measure_char(Free_Glyph_Atlas *atlas, const char *text, size_t text_size, Vec2f *pos)
+{
+    size_t len;
+    uint16_t glyph = free_glyph_atlas_glyph(atlas, utf8_decode(text, text_size, &len));
+    Glyph_Metric metric = atlas->metrics[glyph];
+    pos->x += metric.ax;
+    pos->y += metric.ay;
+    return len;
+}
+
+float free_glyph_atlas_cursor_pos(Free_Glyph_Atlas *atlas, const char *text, size_t text_size, Vec2f pos, size_t col)
+{
+    if (col > text_size) col = text_size;
+    size_t i = 0;
+    while (i < col) {
+        // The ASCII bytes index the metrics directly
+        size_t ascii = utf8_ascii_prefix(text + i, col - i);
+        for (size_t j = i; j < i + ascii; ++j) {
+            pos.x += atlas->metrics[(unsigned char) text[j]].ax;
+        }
+        i += ascii;
+        if (i < col) {
+            i += free_glyph_atlas_measure_char(atlas, text + i, text_size - i, &pos);
+        }
     }
 
     return pos.x;
@@ -97,42 +720,33 @@ float free_glyph_atlas_cursor_pos(const Free_Glyph_Atlas *atlas, const char *tex
 
 void free_glyph_atlas_measure_line_sized(Free_Glyph_Atlas *atlas, const char *text, size_t text_size, Vec2f *pos)
 {
-    for (size_t i = 0; i < text_size; ++i) {
-        size_t glyph_index = text[i];
-        // TODO: support for glyphs outside of ASCII range
-        if (glyph_index >= GLYPH_METRICS_CAPACITY) {
-            glyph_index = '?';
+    size_t i = 0;
+    while (i < text_size) {
+        size_t ascii = utf8_ascii_prefix(text + i, text_size - i);
+        for (size_t j = i; j < i + ascii; ++j) {
+            Glyph_Metric metric = atlas->metrics[(unsigned char) text[j]];
+            pos->x += metric.ax;
+            pos->y += metric.ay;
+        }
+        i += ascii;
+        if (i < text_size) {
+            i += free_glyph_atlas_measure_char(atlas, text + i, text_size - i, pos);
         }
-        Glyph_Metric metric = atlas->metrics[glyph_index];
-
-        pos->x += metric.ax;
-        pos->y += metric.ay;
     }
 }
 
 void free_glyph_atlas_render_line_sized(Free_Glyph_Atlas *atlas, Simple_Renderer *sr, const char *text, size_t text_size, Vec2f *pos, Vec4f color)
 {
-    for (size_t i = 0; i < text_size; ++i) {
-        size_t glyph_index = text[i];
-        // TODO: support for glyphs outside of ASCII range
-        if (glyph_index >= GLYPH_METRICS_CAPACITY) {
-            glyph_index = '?';
+    for (size_t i = 0; i < text_size;) {
+        size_t len = 1;
+        uint16_t glyph = (unsigned char) text[i];
+        if (glyph >= 0x80) {
+            glyph = free_glyph_atlas_glyph(atlas, utf8_decode(text + i, text_size - i, &len));
         }
-        Glyph_Metric metric = atlas->metrics[glyph_index];
-        float x2 = pos->x + metric.bl;
-        float y2 = -pos->y - metric.bt;
-        float w  = metric.bw;
-        float h  = metric.bh;
-
+        Glyph_Metric metric = atlas->metrics[glyph];
+        simple_renderer_glyph(sr, *pos, glyph, color);
         pos->x += metric.ax;
         pos->y += metric.ay;
-
-        simple_renderer_image_rect(
-            sr,
-            vec2f(x2, -y2),
-            vec2f(w, -h),
-            vec2f(metric.tx, 0.0f),
-            vec2f(metric.bw / (float) atlas->atlas_width, metric.bh / (float) atlas->atlas_height),
-            color);
+        i += len;
     }
 }
@@ -2,6 +2,8 @@
 #define FREE_GLYPH_H_
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include "./la.h"
 
 #define GLEW_STATIC
@@ -30,19 +32,65 @@ typedef struct {
     float bt; // bitmap_top;
 
     float tx; // x offset of glyph in texture coordinates
+    float ty; // y offset of glyph in texture coordinates
 } Glyph_Metric;
 
+// The ASCII glyphs are rasterized up front and packed into a region at the top of the atlas. Their
+// glyph index is the character itself.
 #define GLYPH_METRICS_CAPACITY 128
 
+// The rest of Unicode is rasterized on demand into a grid of cells below the ASCII region. The glyph
+// index of the cell i is GLYPH_METRICS_CAPACITY + i. Once all the cells are taken the least recently
+// used one is evicted.
+#define FREE_GLYPH_SDF_SPREAD 8 // the default spread of FT_RENDER_MODE_SDF
+#define FREE_GLYPH_CELL_SIZE (FREE_GLYPH_FONT_SIZE + 2*FREE_GLYPH_SDF_SPREAD)
+#define FREE_GLYPH_CELLS_PER_ROW 16
+#define FREE_GLYPH_CELLS (FREE_GLYPH_CELLS_PER_ROW*16)
+#define FREE_GLYPH_SLOTS (GLYPH_METRICS_CAPACITY + FREE_GLYPH_CELLS)
+// The codepoints missing from the font are remembered too, so they are looked up only once. Once
+// there are too many of them all of them are forgotten.
+#define FREE_GLYPH_MISSING_CAPACITY FREE_GLYPH_CELLS
+// Open addressing, must be a power of 2. Never more than half full.
+#define FREE_GLYPH_CODEPOINTS_CAPACITY (FREE_GLYPH_CELLS*4)
+
+typedef struct {
+    uint32_t codepoint;
+    uint16_t cell;
+    bool missing; // rendered as '?', does not occupy a cell
+    bool occupied;
+} Free_Glyph_Codepoint;
+
 typedef struct {
+    uint32_t codepoint;
+    bool occupied;
+    uint64_t last_used; // Free_Glyph_Atlas.frame
+} Free_Glyph_Cell;
+
+typedef struct {
+    FT_Face face;
     FT_UInt atlas_width;
     FT_UInt atlas_height;
+    FT_UInt ascii_height; // the cells start right below the ASCII region
     GLuint glyphs_texture;
-    Glyph_Metric metrics[GLYPH_METRICS_CAPACITY];
+    GLuint metrics_texture; // see SIMPLE_GLYPH_METRICS_TEXTURE_UNIT
+    Glyph_Metric metrics[FREE_GLYPH_SLOTS];
+
+    Free_Glyph_Codepoint codepoints[FREE_GLYPH_CODEPOINTS_CAPACITY];
+    Free_Glyph_Cell cells[FREE_GLYPH_CELLS];
+    size_t missing_count;
+    // The cells used within the current frame are never evicted, so the glyphs already pushed to the
+    // renderer stay valid until they are drawn. Nothing is guaranteed across the frames, so only the
+    // ASCII glyph indices can be cached for longer than that.
+    uint64_t frame;
 } Free_Glyph_Atlas;
 
-void free_glyph_atlas_init(Free_Glyph_Atlas *atlas, FT_Face face);
-float free_glyph_atlas_cursor_pos(const Free_Glyph_Atlas *atlas, const char *text, size_t text_size, Vec2f pos, size_t col);
+void free_glyph_atlas_init(Free_Glyph_Atlas *atlas, FT_Face face, const char *font_file_path);
+void free_glyph_atlas_begin_frame(Free_Glyph_Atlas *atlas);
+// The glyph index of the codepoint. Rasterizes it if it is not in the atlas yet. Falls back to '?'.
+uint16_t free_glyph_atlas_glyph(Free_Glyph_Atlas *atlas, uint32_t codepoint);
+// Advances the pos by the first character of the UTF-8 text. Returns its length in bytes.
+size_t free_glyph_atlas_measure_char(Free_Glyph_Atlas *atlas, const char *text, size_t text_size, Vec2f *pos);
+float free_glyph_atlas_cursor_pos(Free_Glyph_Atlas *atlas, const char *text, size_t text_size, Vec2f pos, size_t col);
 void free_glyph_atlas_measure_line_sized(Free_Glyph_Atlas *atlas, const char *text, size_t text_size, Vec2f *pos);
 void free_glyph_atlas_render_line_sized(Free_Glyph_Atlas *atlas, Simple_Renderer *sr, const char *text, size_t text_size, Vec2f *pos, Vec4f color);
 
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./keywords_hash.h"
+
+// Generates src/lexer_keywords.h: keywords[] and their perfect hash table as static data, so the
+// lexer has nothing to initialize at run time and no collision can slip in unnoticed.
+//
+// $ ./gen_keywords > src/lexer_keywords.h
+//
+// This is the list to edit when adding a keyword.
+static const char *keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double",
+    "else", "enum", "extern", "float", "for", "goto", "if", "int", "long", "register",
+    "return", "short", "signed", "sizeof", "static", "struct", "switch", "typedef",
+    "union", "unsigned", "void", "volatile", "while", "alignas", "alignof", "and",
+    "and_eq", "asm", "atomic_cancel", "atomic_commit", "atomic_noexcept", "bitand",
+    "bitor", "bool", "catch", "char16_t", "char32_t", "char8_t", "class", "co_await",
+    "co_return", "co_yield", "compl", "concept", "const_cast", "consteval", "constexpr",
+    "constinit", "decltype", "delete", "dynamic_cast", "explicit", "export", "false",
+    "friend", "inline", "mutable", "namespace", "new", "noexcept", "not", "not_eq",
+    "nullptr", "operator", "or", "or_eq", "private", "protected", "public", "reflexpr",
+    "reinterpret_cast", "requires", "static_assert", "static_cast", "synchronized",
+    "template", "this", "thread_local", "throw", "true", "try", "typeid", "typename",
+    "using", "virtual", "wchar_t", "xor", "xor_eq",
+};
+#define keywords_count (sizeof(keywords)/sizeof(keywords[0]))
+
+int main(void)
+{
+    // Indices into keywords[] plus one. Zero means empty slot.
+    size_t table[KEYWORDS_HASH_CAPACITY] = {0};
+    for (size_t i = 0; i < keywords_count; ++i) {
+        size_t keyword_len = strlen(keywords[i]);
+        if (keyword_len == 0 || keyword_len > 255) {
+            fprintf(stderr, "ERROR: the length of keyword `%s` does not fit into uint8_t\n", keywords[i]);
+            return 1;
+        }
+        uint32_t h = keywords_hash(keywords[i], keyword_len);
+        if (table[h] != 0) {
+            fprintf(stderr, "ERROR: keywords `%s` and `%s` collide. Pick other multipliers in keywords_hash()\n",
+                    keywords[table[h] - 1], keywords[i]);
+            return 1;
+        }
+        table[h] = i + 1;
+    }
+    if (keywords_count >= 256) {
+        fprintf(stderr, "ERROR: keyword indices do not fit into uint8_t\n");
+        return 1;
+    }
+
+    printf("// Generated by gen_keywords.c. Do not edit.\n");
+    printf("#ifndef LEXER_KEYWORDS_H_\n");
+    printf("#define LEXER_KEYWORDS_H_\n\n");
+    printf("#include \"./keywords_hash.h\"\n\n");
+
+    printf("const char *keywords[] = {");
+    for (size_t i = 0; i < keywords_count; ++i) {
+        printf("%s\"%s\",", i % 8 == 0 ? "\n    " : " ", keywords[i]);
+    }
+    printf("\n};\n");
+    printf("const size_t keywords_count = %zu;\n\n", keywords_count);
+
+    printf("// Indices into keywords[] plus one and the lengths of the keywords by their hash\n");
+    printf("static const struct {\n");
+    printf("    uint8_t index;\n");
+    printf("    uint8_t len;\n");
+    printf("} keywords_hash_table[KEYWORDS_HASH_CAPACITY] = {\n");
+    for (size_t h = 0; h < KEYWORDS_HASH_CAPACITY; ++h) {
+        if (table[h] == 0) continue;
+        const char *keyword = keywords[table[h] - 1];
+        printf("    [%zu] = {%zu, %zu}, // %s\n", h, table[h], strlen(keyword), keyword);
+    }
+    printf("};\n\n");
+    printf("#endif // LEXER_KEYWORDS_H_\n");
+
+    return 0;
+}
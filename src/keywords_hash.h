@@ -0,0 +1,27 @@
+#ifndef KEYWORDS_HASH_H_
+#define KEYWORDS_HASH_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Perfect hash of the keywords of the lexer. It looks only at the length and 3 characters of the
+// symbol, so classifying a symbol costs a single probe and at most one memcmp() regardless of the
+// amount of keywords. The multipliers were brute forced so no two keywords share a slot. The table
+// itself is generated by gen_keywords, which fails if a newly added keyword collides. Just find new
+// multipliers then.
+#define KEYWORDS_HASH_BITS 9
+#define KEYWORDS_HASH_CAPACITY (1 << KEYWORDS_HASH_BITS)
+
+static inline uint32_t keywords_hash(const char *text, size_t text_len)
+{
+    assert(text_len > 0);
+    uint32_t x = (uint32_t) text_len
+        + (uint32_t) (unsigned char) text[0]*10
+        + (uint32_t) (unsigned char) text[text_len/2]*8
+        + (uint32_t) (unsigned char) text[text_len - 1]*32;
+    // Fibonacci hashing https://en.wikipedia.org/wiki/Hash_function#Fibonacci_hashing
+    return (x*0x9E3779B1u) >> (32 - KEYWORDS_HASH_BITS);
+}
+
+#endif // KEYWORDS_HASH_H_
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdbool.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "common.h"
 #include "lexer.h"
@@ -19,22 +20,18 @@ Literal_Token literal_tokens[] = {
 };
 #define literal_tokens_count (sizeof(literal_tokens)/sizeof(literal_tokens[0]))
 
-const char *keywords[] = {
-    "auto", "break", "case", "char", "const", "continue", "default", "do", "double",
-    "else", "enum", "extern", "float", "for", "goto", "if", "int", "long", "register",
-    "return", "short", "signed", "sizeof", "static", "struct", "switch", "typedef",
-    "union", "unsigned", "void", "volatile", "while", "alignas", "alignof", "and",
-    "and_eq", "asm", "atomic_cancel", "atomic_commit", "atomic_noexcept", "bitand",
-    "bitor", "bool", "catch", "char16_t", "char32_t", "char8_t", "class", "co_await",
-    "co_return", "co_yield", "compl", "concept", "const_cast", "consteval", "constexpr",
-    "constinit", "decltype", "delete", "dynamic_cast", "explicit", "export", "false",
-    "friend", "inline", "mutable", "namespace", "new", "noexcept", "not", "not_eq",
-    "nullptr", "operator", "or", "or_eq", "private", "protected", "public", "reflexpr",
-    "reinterpret_cast", "requires", "static_assert", "static_cast", "synchronized",
-    "template", "this", "thread_local", "throw", "true", "try", "typeid", "typename",
-    "using", "virtual", "wchar_t", "xor", "xor_eq",
-};
-#define keywords_count (sizeof(keywords)/sizeof(keywords[0]))
+// keywords[] and their hash table. Edit the list in gen_keywords.c and regenerate it.
+#include "./lexer_keywords.h"
+
+bool lexer_is_keyword(const char *text, size_t text_len)
+{
+    if (text_len == 0) return false;
+    uint32_t h = keywords_hash(text, text_len);
+    uint8_t index = keywords_hash_table[h].index;
+    return index != 0
+        && keywords_hash_table[h].len == text_len
+        && memcmp(keywords[index - 1], text, text_len) == 0;
+}
 
 const char *token_kind_name(Token_Kind kind)
 {
@@ -59,78 +56,195 @@ const char *token_kind_name(Token_Kind kind)
         return "semicolon";
     case TOKEN_KEYWORD:
         return "keyword";
+    case TOKEN_COMMENT:
+        return "comment";
+    case TOKEN_STRING:
+        return "string";
     default:
         UNREACHABLE("token_kind_name");
     }
     return NULL;
 }
 
-Lexer lexer_new(Free_Glyph_Atlas *atlas, const char *content, size_t content_len)
-{
-    Lexer l = {0};
-    l.atlas = atlas;
-    l.content = content;
-    l.content_len = content_len;
-    return l;
-}
+// The lexer is a DFA. Every byte is mapped to its class with a single lookup and the class drives
+// the transitions, so each token is scanned by one tight loop without any per-byte calls.
+typedef enum {
+    CHAR_CLASS_OTHER = 0,
+    CHAR_CLASS_SPACE,
+    CHAR_CLASS_NEWLINE,
+    CHAR_CLASS_SYMBOL,
+    CHAR_CLASS_DIGIT,
+    CHAR_CLASS_QUOTE,
+    CHAR_CLASS_HASH,
+    CHAR_CLASS_SLASH,
+    CHAR_CLASS_STAR,
+    CHAR_CLASS_BACKSLASH,
+    CHAR_CLASS_LITERAL, // one of literal_tokens
+    COUNT_CHAR_CLASSES,
+} Char_Class;
 
-bool lexer_starts_with(Lexer *l, const char *prefix)
+typedef enum {
+    DFA_DONE = 0, // the byte does not belong to the token
+    DFA_START,
+    DFA_SYMBOL,
+    DFA_STRING,
+    DFA_STRING_END,
+    DFA_SLASH,
+    DFA_LINE_COMMENT,
+    DFA_BLOCK_COMMENT,
+    DFA_BLOCK_COMMENT_STAR,
+    DFA_BLOCK_COMMENT_END,
+    DFA_PREPROC,
+    DFA_PREPROC_BACKSLASH,
+    DFA_LITERAL,
+    DFA_INVALID,
+    COUNT_DFA_STATES,
+} Dfa_State;
+
+// What the token is if it ends in the given DFA state, and what state the lexer is left in
+typedef struct {
+    Token_Kind kind;
+    Lexer_State lexer_state;
+} Dfa_Accept;
+
+static const Dfa_Accept dfa_accepts[COUNT_DFA_STATES] = {
+    [DFA_SYMBOL]             = {TOKEN_SYMBOL,  LEXER_STATE_NORMAL},
+    [DFA_STRING]             = {TOKEN_STRING,  LEXER_STATE_NORMAL},
+    [DFA_STRING_END]         = {TOKEN_STRING,  LEXER_STATE_NORMAL},
+    [DFA_SLASH]              = {TOKEN_INVALID, LEXER_STATE_NORMAL},
+    [DFA_LINE_COMMENT]       = {TOKEN_COMMENT, LEXER_STATE_NORMAL},
+    [DFA_BLOCK_COMMENT]      = {TOKEN_COMMENT, LEXER_STATE_BLOCK_COMMENT},
+    [DFA_BLOCK_COMMENT_STAR] = {TOKEN_COMMENT, LEXER_STATE_BLOCK_COMMENT},
+    [DFA_BLOCK_COMMENT_END]  = {TOKEN_COMMENT, LEXER_STATE_NORMAL},
+    [DFA_PREPROC]            = {TOKEN_PREPROC, LEXER_STATE_NORMAL},
+    [DFA_PREPROC_BACKSLASH]  = {TOKEN_PREPROC, LEXER_STATE_PREPROC},
+    [DFA_LITERAL]            = {TOKEN_INVALID, LEXER_STATE_NORMAL}, // the kind comes from literal_kinds
+    [DFA_INVALID]            = {TOKEN_INVALID, LEXER_STATE_NORMAL},
+};
+
+static uint8_t char_classes[256] = {0};
+static uint8_t literal_kinds[256] = {0};
+static uint8_t dfa_transitions[COUNT_DFA_STATES][COUNT_CHAR_CLASSES] = {0};
+static bool lexer_tables_ready = false;
+
+static void dfa_set_all(Dfa_State state, Dfa_State next)
 {
-    size_t prefix_len = strlen(prefix);
-    if (prefix_len == 0) {
-        return true;
+    for (size_t cls = 0; cls < COUNT_CHAR_CLASSES; ++cls) {
+        dfa_transitions[state][cls] = next;
     }
-    if (l->cursor + prefix_len - 1 >= l->content_len) {
-        return false;
-    }
-    for (size_t i = 0; i < prefix_len; ++i) {
-        if (prefix[i] != l->content[l->cursor + i]) {
-            return false;
-        }
-    }
-    return true;
 }
 
-void lexer_chop_char(Lexer *l, size_t len)
+static void lexer_tables_init(void)
 {
-    for (size_t i = 0; i < len; ++i) {
-        // TODO: get rid of this assert by checking the length of the choped prefix upfront
-        assert(l->cursor < l->content_len);
-        char x = l->content[l->cursor];
-        l->cursor += 1;
-        if (x == '\n') {
-            l->line += 1;
-            l->bol = l->cursor;
-            l->x = 0;
-        } else {
-            if (l->atlas) {
-                size_t glyph_index = x;
-                // TODO: support for glyphs outside of ASCII range
-                if (glyph_index >= GLYPH_METRICS_CAPACITY) {
-                    glyph_index = '?';
-                }
-                Glyph_Metric metric = l->atlas->metrics[glyph_index];
-                l->x += metric.ax;
-            }
+    for (size_t c = 0; c < 256; ++c) {
+        if (c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+            char_classes[c] = CHAR_CLASS_SYMBOL;
+        } else if (c >= '0' && c <= '9') {
+            char_classes[c] = CHAR_CLASS_DIGIT;
+        } else if (c >= 0x80) {
+            // NOTE: the bytes of UTF-8 sequences are treated as the part of symbols, so a token never
+            // ends in the middle of a character
+            char_classes[c] = CHAR_CLASS_SYMBOL;
         }
     }
+    char_classes[' ']  = CHAR_CLASS_SPACE;
+    char_classes['\t'] = CHAR_CLASS_SPACE;
+    char_classes['\v'] = CHAR_CLASS_SPACE;
+    char_classes['\f'] = CHAR_CLASS_SPACE;
+    char_classes['\r'] = CHAR_CLASS_SPACE;
+    char_classes['\n'] = CHAR_CLASS_NEWLINE;
+    char_classes['"']  = CHAR_CLASS_QUOTE;
+    char_classes['#']  = CHAR_CLASS_HASH;
+    char_classes['/']  = CHAR_CLASS_SLASH;
+    char_classes['*']  = CHAR_CLASS_STAR;
+    char_classes['\\'] = CHAR_CLASS_BACKSLASH;
+    for (size_t i = 0; i < literal_tokens_count; ++i) {
+        // NOTE: only single character literal tokens are supported by the DFA
+        assert(strlen(literal_tokens[i].text) == 1);
+        unsigned char c = literal_tokens[i].text[0];
+        assert(char_classes[c] == CHAR_CLASS_OTHER);
+        char_classes[c] = CHAR_CLASS_LITERAL;
+        literal_kinds[c] = literal_tokens[i].kind;
+    }
+
+    dfa_set_all(DFA_START, DFA_INVALID);
+    dfa_transitions[DFA_START][CHAR_CLASS_SPACE]   = DFA_DONE; // skipped by lexer_trim_left()
+    dfa_transitions[DFA_START][CHAR_CLASS_NEWLINE] = DFA_DONE;
+    dfa_transitions[DFA_START][CHAR_CLASS_SYMBOL]  = DFA_SYMBOL;
+    dfa_transitions[DFA_START][CHAR_CLASS_QUOTE]   = DFA_STRING;
+    dfa_transitions[DFA_START][CHAR_CLASS_HASH]    = DFA_PREPROC;
+    dfa_transitions[DFA_START][CHAR_CLASS_SLASH]   = DFA_SLASH;
+    dfa_transitions[DFA_START][CHAR_CLASS_LITERAL] = DFA_LITERAL;
+
+    dfa_transitions[DFA_SYMBOL][CHAR_CLASS_SYMBOL] = DFA_SYMBOL;
+    dfa_transitions[DFA_SYMBOL][CHAR_CLASS_DIGIT]  = DFA_SYMBOL;
+
+    // TODO: TOKEN_STRING should also handle escape sequences
+    dfa_set_all(DFA_STRING, DFA_STRING);
+    dfa_transitions[DFA_STRING][CHAR_CLASS_QUOTE]   = DFA_STRING_END;
+    dfa_transitions[DFA_STRING][CHAR_CLASS_NEWLINE] = DFA_DONE;
+
+    dfa_transitions[DFA_SLASH][CHAR_CLASS_SLASH] = DFA_LINE_COMMENT;
+    dfa_transitions[DFA_SLASH][CHAR_CLASS_STAR]  = DFA_BLOCK_COMMENT;
+
+    dfa_set_all(DFA_LINE_COMMENT, DFA_LINE_COMMENT);
+    dfa_transitions[DFA_LINE_COMMENT][CHAR_CLASS_NEWLINE] = DFA_DONE;
+
+    dfa_set_all(DFA_BLOCK_COMMENT, DFA_BLOCK_COMMENT);
+    dfa_transitions[DFA_BLOCK_COMMENT][CHAR_CLASS_STAR]    = DFA_BLOCK_COMMENT_STAR;
+    dfa_transitions[DFA_BLOCK_COMMENT][CHAR_CLASS_NEWLINE] = DFA_DONE;
+
+    dfa_set_all(DFA_BLOCK_COMMENT_STAR, DFA_BLOCK_COMMENT);
+    dfa_transitions[DFA_BLOCK_COMMENT_STAR][CHAR_CLASS_STAR]    = DFA_BLOCK_COMMENT_STAR;
+    dfa_transitions[DFA_BLOCK_COMMENT_STAR][CHAR_CLASS_SLASH]   = DFA_BLOCK_COMMENT_END;
+    dfa_transitions[DFA_BLOCK_COMMENT_STAR][CHAR_CLASS_NEWLINE] = DFA_DONE;
+
+    dfa_set_all(DFA_PREPROC, DFA_PREPROC);
+    dfa_transitions[DFA_PREPROC][CHAR_CLASS_BACKSLASH] = DFA_PREPROC_BACKSLASH;
+    dfa_transitions[DFA_PREPROC][CHAR_CLASS_NEWLINE]   = DFA_DONE;
+
+    dfa_set_all(DFA_PREPROC_BACKSLASH, DFA_PREPROC);
+    dfa_transitions[DFA_PREPROC_BACKSLASH][CHAR_CLASS_BACKSLASH] = DFA_PREPROC_BACKSLASH;
+    dfa_transitions[DFA_PREPROC_BACKSLASH][CHAR_CLASS_NEWLINE]   = DFA_DONE;
+
+    // DFA_STRING_END, DFA_BLOCK_COMMENT_END, DFA_LITERAL and DFA_INVALID are always left as DFA_DONE
+
+    lexer_tables_ready = true;
 }
 
-void lexer_trim_left(Lexer *l)
+Lexer lexer_new(const char *content, size_t content_len)
 {
-    while (l->cursor < l->content_len && isspace(l->content[l->cursor])) {
-        lexer_chop_char(l, 1);
-    }
+    if (!lexer_tables_ready) lexer_tables_init();
+
+    Lexer l = {0};
+    l.content = content;
+    l.content_len = content_len;
+    return l;
 }
 
-bool is_symbol_start(char x)
+static void lexer_trim_left(Lexer *l)
 {
-    return isalpha(x) || x == '_';
+    while (l->cursor < l->content_len) {
+        while (l->cursor < l->content_len && char_classes[(unsigned char) l->content[l->cursor]] == CHAR_CLASS_SPACE) {
+            l->cursor += 1;
+        }
+
+        if (l->cursor >= l->content_len || l->content[l->cursor] != '\n') break;
+
+        // The directive is continued only onto the very next line after the backslash
+        if (l->state == LEXER_STATE_PREPROC && (l->cursor == 0 || l->content[l->cursor - 1] != '\\')) {
+            l->state = LEXER_STATE_NORMAL;
+        }
+        l->cursor += 1;
+    }
 }
 
-bool is_symbol(char x)
+Lexer_State lexer_line_end_state(const Lexer *l)
 {
-    return isalnum(x) || x == '_';
+    if (l->state == LEXER_STATE_PREPROC && (l->content_len == 0 || l->content[l->content_len - 1] != '\\')) {
+        return LEXER_STATE_NORMAL;
+    }
+    return l->state;
 }
 
 Token lexer_next(Lexer *l)
@@ -138,84 +252,94 @@ Token lexer_next(Lexer *l)
     lexer_trim_left(l);
 
     Token token = {
-        .text = &l->content[l->cursor],
+        .begin = l->cursor,
     };
 
-    token.position.x = l->x;
-    token.position.y = -(float)l->line * FREE_GLYPH_FONT_SIZE;
-
     if (l->cursor >= l->content_len) return token;
 
-    if (l->content[l->cursor] == '"') {
-        // TODO: TOKEN_STRING should also handle escape sequences
-        token.kind = TOKEN_STRING;
-        lexer_chop_char(l, 1);
-        while (l->cursor < l->content_len && l->content[l->cursor] != '"' && l->content[l->cursor] != '\n') {
-            lexer_chop_char(l, 1);
-        }
-        if (l->cursor < l->content_len) {
-            lexer_chop_char(l, 1);
-        }
-        token.text_len = &l->content[l->cursor] - token.text;
-        return token;
+    Dfa_State state = DFA_START;
+    switch (l->state) {
+    case LEXER_STATE_BLOCK_COMMENT:
+        state = DFA_BLOCK_COMMENT;
+        break;
+    case LEXER_STATE_PREPROC:
+        state = DFA_PREPROC;
+        break;
+    case LEXER_STATE_NORMAL:
+    default:
+    {}
     }
 
-    if (l->content[l->cursor] == '#') {
-        // TODO: preproc should also handle newlines
-        token.kind = TOKEN_PREPROC;
-        while (l->cursor < l->content_len && l->content[l->cursor] != '\n') {
-            lexer_chop_char(l, 1);
-        }
-        if (l->cursor < l->content_len) {
-            lexer_chop_char(l, 1);
-        }
-        token.text_len = &l->content[l->cursor] - token.text;
-        return token;
+    const unsigned char *content = (const unsigned char *) l->content;
+    size_t end = l->cursor;
+    while (end < l->content_len) {
+        Dfa_State next = dfa_transitions[state][char_classes[content[end]]];
+        if (next == DFA_DONE) break;
+        state = next;
+        end += 1;
     }
+    assert(end > l->cursor || state != DFA_START);
 
-    if (lexer_starts_with(l, "//")) {
-        token.kind = TOKEN_COMMENT;
-        while (l->cursor < l->content_len && l->content[l->cursor] != '\n') {
-            lexer_chop_char(l, 1);
-        }
-        if (l->cursor < l->content_len) {
-            lexer_chop_char(l, 1);
-        }
-        token.text_len = &l->content[l->cursor] - token.text;
-        return token;
-    }
-    
-    for (size_t i = 0; i < literal_tokens_count; ++i) {
-        if (lexer_starts_with(l, literal_tokens[i].text)) {
-            // NOTE: this code assumes that there is no newlines in literal_tokens[i].text
-            size_t text_len = strlen(literal_tokens[i].text);
-            token.kind = literal_tokens[i].kind;
-            token.text_len = text_len;
-            lexer_chop_char(l, text_len);
-            return token;
+    token.kind = dfa_accepts[state].kind;
+    token.text_len = end - l->cursor;
+    l->state = dfa_accepts[state].lexer_state;
+
+    switch (state) {
+    case DFA_LITERAL:
+        token.kind = literal_kinds[content[l->cursor]];
+        break;
+    case DFA_SYMBOL:
+        if (lexer_is_keyword(&l->content[token.begin], token.text_len)) {
+            token.kind = TOKEN_KEYWORD;
         }
+        break;
+    default:
+    {}
     }
 
-    if (is_symbol_start(l->content[l->cursor])) {
-        token.kind = TOKEN_SYMBOL;
-        while (l->cursor < l->content_len && is_symbol(l->content[l->cursor])) {
-            lexer_chop_char(l, 1);
-            token.text_len += 1;
-        }
+    l->cursor = end;
+    return token;
+}
 
-        for (size_t i = 0; i < keywords_count; ++i) {
-            size_t keyword_len = strlen(keywords[i]);
-            if (keyword_len == token.text_len && memcmp(keywords[i], token.text, keyword_len) == 0) {
-                token.kind = TOKEN_KEYWORD;
-                break;
-            }
-        }
+void compact_tokens_set(Compact_Tokens *ct, const Token *tokens, size_t tokens_count)
+{
+    if (tokens_count == 0) {
+        compact_tokens_free(ct);
+        return;
+    }
+
+    ct->data = realloc(ct->data, tokens_count*COMPACT_TOKEN_SIZE);
+    assert(ct->data != NULL && "Buy more RAM lol");
+    ct->count = tokens_count;
 
-        return token;
+    uint32_t *begins = ct->data;
+    uint32_t *lens = begins + tokens_count;
+    uint8_t *kinds = (uint8_t *) (lens + tokens_count);
+    for (size_t i = 0; i < tokens_count; ++i) {
+        assert(tokens[i].begin + tokens[i].text_len <= UINT32_MAX);
+        begins[i] = (uint32_t) tokens[i].begin;
+        lens[i] = (uint32_t) tokens[i].text_len;
+        kinds[i] = (uint8_t) tokens[i].kind;
     }
+}
 
-    lexer_chop_char(l, 1);
-    token.kind = TOKEN_INVALID;
-    token.text_len = 1;
+Token compact_tokens_get(const Compact_Tokens *ct, size_t index)
+{
+    assert(index < ct->count);
+    const uint32_t *begins = ct->data;
+    const uint32_t *lens = begins + ct->count;
+    const uint8_t *kinds = (const uint8_t *) (lens + ct->count);
+    Token token = {
+        .kind = kinds[index],
+        .begin = begins[index],
+        .text_len = lens[index],
+    };
     return token;
 }
+
+void compact_tokens_free(Compact_Tokens *ct)
+{
+    free(ct->data);
+    ct->data = NULL;
+    ct->count = 0;
+}
@@ -2,8 +2,8 @@
 #define LEXER_H_
 
 #include <stddef.h>
-#include "./la.h"
-#include "./free_glyph.h"
+#include <stdint.h>
+#include <stdbool.h>
 
 typedef enum {
     TOKEN_END = 0,
@@ -24,22 +24,57 @@ const char *token_kind_name(Token_Kind kind);
 
 typedef struct {
     Token_Kind kind;
-    const char *text;
+    size_t begin; // offset of the text of the token within the content of the lexer
     size_t text_len;
-    Vec2f position;
 } Token;
 
 typedef struct {
-    Free_Glyph_Atlas *atlas;
+    Token *items;
+    size_t count;
+    size_t capacity;
+} Tokens;
+
+// Tokens packed for long term storage: 32 bit offsets, 32 bit lengths and 8 bit kinds in separate
+// arrays of a single allocation, so 9 bytes per token instead of sizeof(Token).
+// NOTE: the offsets are expected to be relative to something short like a line, not to the whole file.
+typedef struct {
+    void *data; // uint32_t begins[count], uint32_t lens[count], uint8_t kinds[count]
+    size_t count;
+} Compact_Tokens;
+
+#define COMPACT_TOKEN_SIZE (2*sizeof(uint32_t) + sizeof(uint8_t))
+
+void compact_tokens_set(Compact_Tokens *ct, const Token *tokens, size_t tokens_count);
+Token compact_tokens_get(const Compact_Tokens *ct, size_t index);
+void compact_tokens_free(Compact_Tokens *ct);
+
+// What the lexer carries over from one line to another.
+// NOTE: none of the tokens include newlines, so the lexer can be resumed at the beginning of any
+// line knowing only its state there.
+typedef enum {
+    LEXER_STATE_NORMAL = 0,
+    LEXER_STATE_BLOCK_COMMENT,
+    LEXER_STATE_PREPROC, // the previous line of the directive ended with '\'
+} Lexer_State;
+
+// NOTE: the lexer knows nothing about the font. The tokens are laid out on the screen separately
+// only when they are rendered.
+typedef struct {
     const char *content;
     size_t content_len;
     size_t cursor;
-    size_t line;
-    size_t bol;
-    float x;
+    Lexer_State state;
 } Lexer;
 
-Lexer lexer_new(Free_Glyph_Atlas *atlas, const char *content, size_t content_len);
+extern const char *keywords[];
+extern const size_t keywords_count;
+bool lexer_is_keyword(const char *text, size_t text_len);
+
+Lexer lexer_new(const char *content, size_t content_len);
 Token lexer_next(Lexer *l);
+// The state to start the next line in once the lexer has reached the end of a single line. The
+// '\n' after the line is never in the content, so the directive is ended here unless the line is
+// continued with '\'.
+Lexer_State lexer_line_end_state(const Lexer *l);
 
 #endif // LEXER_H_
@@ -0,0 +1,128 @@
+// Generated by gen_keywords.c. Do not edit.
+#ifndef LEXER_KEYWORDS_H_
+#define LEXER_KEYWORDS_H_
+
+#include "./keywords_hash.h"
+
+const char *keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if",
+    "int", "long", "register", "return", "short", "signed", "sizeof", "static",
+    "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
+    "alignas", "alignof", "and", "and_eq", "asm", "atomic_cancel", "atomic_commit", "atomic_noexcept",
+    "bitand", "bitor", "bool", "catch", "char16_t", "char32_t", "char8_t", "class",
+    "co_await", "co_return", "co_yield", "compl", "concept", "const_cast", "consteval", "constexpr",
+    "constinit", "decltype", "delete", "dynamic_cast", "explicit", "export", "false", "friend",
+    "inline", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr",
+    "operator", "or", "or_eq", "private", "protected", "public", "reflexpr", "reinterpret_cast",
+    "requires", "static_assert", "static_cast", "synchronized", "template", "this", "thread_local", "throw",
+    "true", "try", "typeid", "typename", "using", "virtual", "wchar_t", "xor",
+    "xor_eq",
+};
+const size_t keywords_count = 97;
+
+// Indices into keywords[] plus one and the lengths of the keywords by their hash
+static const struct {
+    uint8_t index;
+    uint8_t len;
+} keywords_hash_table[KEYWORDS_HASH_CAPACITY] = {
+    [6] = {29, 8}, // unsigned
+    [8] = {81, 8}, // requires
+    [13] = {22, 6}, // signed
+    [31] = {71, 6}, // not_eq
+    [32] = {66, 7}, // mutable
+    [34] = {94, 7}, // virtual
+    [35] = {25, 6}, // struct
+    [38] = {60, 12}, // dynamic_cast
+    [41] = {23, 6}, // sizeof
+    [47] = {57, 9}, // constinit
+    [49] = {7, 7}, // default
+    [50] = {46, 8}, // char32_t
+    [66] = {88, 5}, // throw
+    [73] = {73, 8}, // operator
+    [81] = {38, 13}, // atomic_cancel
+    [83] = {83, 11}, // static_cast
+    [93] = {64, 6}, // friend
+    [94] = {32, 5}, // while
+    [107] = {45, 8}, // char16_t
+    [112] = {92, 8}, // typename
+    [115] = {20, 6}, // return
+    [121] = {80, 16}, // reinterpret_cast
+    [125] = {31, 8}, // volatile
+    [136] = {50, 9}, // co_return
+    [142] = {65, 6}, // inline
+    [145] = {2, 5}, // break
+    [151] = {44, 5}, // catch
+    [157] = {49, 8}, // co_await
+    [169] = {85, 8}, // template
+    [174] = {8, 2}, // do
+    [175] = {34, 7}, // alignof
+    [182] = {89, 4}, // true
+    [192] = {39, 13}, // atomic_commit
+    [193] = {93, 5}, // using
+    [206] = {3, 4}, // case
+    [208] = {69, 8}, // noexcept
+    [221] = {6, 8}, // continue
+    [222] = {76, 7}, // private
+    [225] = {13, 5}, // float
+    [227] = {33, 7}, // alignas
+    [229] = {90, 3}, // try
+    [230] = {61, 8}, // explicit
+    [236] = {79, 8}, // reflexpr
+    [244] = {67, 9}, // namespace
+    [250] = {74, 2}, // or
+    [260] = {4, 4}, // char
+    [267] = {95, 7}, // wchar_t
+    [274] = {68, 3}, // new
+    [276] = {56, 9}, // constexpr
+    [306] = {59, 6}, // delete
+    [312] = {30, 4}, // void
+    [318] = {82, 13}, // static_assert
+    [319] = {75, 5}, // or_eq
+    [328] = {37, 3}, // asm
+    [331] = {70, 3}, // not
+    [333] = {14, 3}, // for
+    [335] = {51, 8}, // co_yield
+    [347] = {84, 12}, // synchronized
+    [349] = {19, 8}, // register
+    [350] = {41, 6}, // bitand
+    [362] = {91, 6}, // typeid
+    [367] = {36, 6}, // and_eq
+    [375] = {72, 7}, // nullptr
+    [384] = {16, 2}, // if
+    [387] = {1, 4}, // auto
+    [390] = {10, 4}, // else
+    [392] = {9, 6}, // double
+    [396] = {12, 6}, // extern
+    [397] = {40, 15}, // atomic_noexcept
+    [402] = {21, 5}, // short
+    [406] = {52, 5}, // compl
+    [409] = {26, 6}, // switch
+    [410] = {17, 3}, // int
+    [412] = {53, 7}, // concept
+    [418] = {28, 5}, // union
+    [419] = {78, 6}, // public
+    [429] = {15, 4}, // goto
+    [430] = {77, 9}, // protected
+    [439] = {18, 4}, // long
+    [443] = {97, 6}, // xor_eq
+    [444] = {11, 4}, // enum
+    [448] = {55, 9}, // consteval
+    [449] = {62, 6}, // export
+    [450] = {27, 7}, // typedef
+    [451] = {54, 10}, // const_cast
+    [453] = {43, 4}, // bool
+    [454] = {42, 5}, // bitor
+    [459] = {96, 3}, // xor
+    [462] = {48, 5}, // class
+    [463] = {86, 4}, // this
+    [468] = {24, 6}, // static
+    [473] = {35, 3}, // and
+    [487] = {63, 5}, // false
+    [489] = {5, 5}, // const
+    [495] = {87, 12}, // thread_local
+    [496] = {47, 7}, // char8_t
+    [511] = {58, 8}, // decltype
+};
+
+#endif // LEXER_KEYWORDS_H_
@@ -0,0 +1,508 @@
+#include <assert.h>
+#include <string.h>
+
+// NOTE: build.sh does not pass -mavx2. So unless the compiler targets AVX2 anyway, the AVX2 path is
+// compiled for it separately with the target attribute and picked at run time if the CPU has it.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LINE_INDEX_AVX2
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LINE_INDEX_AVX2
+#define LINE_INDEX_AVX2_DISPATCH
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LINE_INDEX_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "./common.h"
+#include "./line_index.h"
+
+
+static uint32_t line_index_random(Line_Index *li)
+{
+    // xorshift32
+    if (li->seed == 0) li->seed = 0x9E3779B9;
+    uint32_t x = li->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    li->seed = x;
+    return x;
+}
+
+static void line_index_update(Line_Index *li, size_t node)
+{
+    Line_Node *n = &li->nodes.items[node];
+    const Line_Node *l = &li->nodes.items[n->left];
+    const Line_Node *r = &li->nodes.items[n->right];
+    n->subtree_count = l->subtree_count + n->count + r->subtree_count;
+    n->subtree_lines = l->subtree_lines + 1 + r->subtree_lines;
+    n->subtree_dirty = l->subtree_dirty + n->dirty + r->subtree_dirty;
+}
+
+static size_t line_index_alloc(Line_Index *li, size_t count)
+{
+    if (li->nodes.count == 0) {
+        Line_Node nil = {0};
+        da_append(&li->nodes, nil);
+    }
+
+    size_t node;
+    if (li->free_list != 0) {
+        node = li->free_list;
+        li->free_list = li->nodes.items[node].left;
+    } else {
+        node = li->nodes.count;
+        Line_Node line_node = {0};
+        da_append(&li->nodes, line_node);
+    }
+
+    Line_Node *n = &li->nodes.items[node];
+    n->left = 0;
+    n->right = 0;
+    n->priority = line_index_random(li);
+    n->count = count;
+    n->subtree_count = count;
+    n->subtree_lines = 1;
+    n->dirty = true;
+    n->subtree_dirty = 1;
+    n->lexer_state = LEXER_STATE_NORMAL;
+    n->tokens.data = NULL;
+    n->tokens.count = 0;
+    n->version = 0;
+    return node;
+}
+
+static void line_index_release(Line_Index *li, size_t node)
+{
+    if (node == 0) return;
+    line_index_release(li, li->nodes.items[node].left);
+    line_index_release(li, li->nodes.items[node].right);
+    compact_tokens_free(&li->nodes.items[node].tokens);
+    li->nodes.items[node].left = li->free_list;
+    li->free_list = node;
+}
+
+// Splits the tree into the first `rows` lines and the rest.
+static void line_index_split(Line_Index *li, size_t node, size_t rows, size_t *left, size_t *right)
+{
+    if (node == 0) {
+        *left = 0;
+        *right = 0;
+        return;
+    }
+
+    size_t left_lines = li->nodes.items[li->nodes.items[node].left].subtree_lines;
+    size_t l, r;
+    if (rows <= left_lines) {
+        line_index_split(li, li->nodes.items[node].left, rows, &l, &r);
+        li->nodes.items[node].left = r;
+        line_index_update(li, node);
+        *left = l;
+        *right = node;
+    } else {
+        line_index_split(li, li->nodes.items[node].right, rows - left_lines - 1, &l, &r);
+        li->nodes.items[node].right = l;
+        line_index_update(li, node);
+        *left = node;
+        *right = r;
+    }
+}
+
+static size_t line_index_merge(Line_Index *li, size_t left, size_t right)
+{
+    if (left == 0) return right;
+    if (right == 0) return left;
+
+    if (li->nodes.items[left].priority >= li->nodes.items[right].priority) {
+        size_t merged = line_index_merge(li, li->nodes.items[left].right, right);
+        li->nodes.items[left].right = merged;
+        line_index_update(li, left);
+        return left;
+    } else {
+        size_t merged = line_index_merge(li, left, li->nodes.items[right].left);
+        li->nodes.items[right].left = merged;
+        line_index_update(li, right);
+        return right;
+    }
+}
+
+// Building the tree out of a sequence of lines in O(lines) by maintaining the right spine of the
+// tree on a stack (https://en.wikipedia.org/wiki/Cartesian_tree#Efficient_construction)
+static size_t line_index_push(Line_Index *li, size_t count)
+{
+    size_t node = line_index_alloc(li, count);
+    size_t last = 0;
+    while (li->stack.count > 0 && li->nodes.items[li->stack.items[li->stack.count - 1]].priority < li->nodes.items[node].priority) {
+        last = li->stack.items[--li->stack.count];
+        line_index_update(li, last);
+    }
+    li->nodes.items[node].left = last;
+    if (li->stack.count > 0) {
+        li->nodes.items[li->stack.items[li->stack.count - 1]].right = node;
+    }
+    da_append(&li->stack, node);
+    return node;
+}
+
+static size_t line_index_pop_all(Line_Index *li)
+{
+    size_t root = 0;
+    while (li->stack.count > 0) {
+        root = li->stack.items[--li->stack.count];
+        line_index_update(li, root);
+    }
+    return root;
+}
+
+static size_t line_index_find_row(const Line_Index *li, size_t row, size_t *begin)
+{
+    *begin = 0;
+    size_t node = li->root;
+    while (node != 0) {
+        const Line_Node *n = &li->nodes.items[node];
+        const Line_Node *l = &li->nodes.items[n->left];
+        if (row < l->subtree_lines) {
+            node = n->left;
+        } else if (row == l->subtree_lines) {
+            *begin += l->subtree_count;
+            return node;
+        } else {
+            row -= l->subtree_lines + 1;
+            *begin += l->subtree_count + n->count;
+            node = n->right;
+        }
+    }
+    return 0;
+}
+
+static void line_index_resize(Line_Index *li, size_t row, size_t new_count)
+{
+    size_t begin;
+    const Line_Node *target = &li->nodes.items[line_index_find_row(li, row, &begin)];
+    size_t old_count = target->count;
+    size_t became_dirty = !target->dirty;
+
+    size_t node = li->root;
+    while (node != 0) {
+        Line_Node *n = &li->nodes.items[node];
+        size_t left_lines = li->nodes.items[n->left].subtree_lines;
+        n->subtree_count = n->subtree_count - old_count + new_count;
+        n->subtree_dirty += became_dirty;
+        if (row < left_lines) {
+            node = n->left;
+        } else if (row == left_lines) {
+            n->count = new_count;
+            n->dirty = true;
+            return;
+        } else {
+            row -= left_lines + 1;
+            node = n->right;
+        }
+    }
+}
+
+static void line_index_ensure(Line_Index *li)
+{
+    if (li->root == 0) {
+        li->root = line_index_alloc(li, 0);
+    }
+}
+
+#if defined(LINE_INDEX_AVX2) || defined(LINE_INDEX_SSE2)
+static uint32_t count_trailing_zeros(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+#endif
+
+void newlines_scan_scalar(Newlines *nls, const char *text, size_t text_len)
+{
+    assert(text_len <= LINE_INDEX_MAX_CHUNK);
+    for (size_t i = 0; i < text_len; ++i) {
+        if (text[i] == '\n') {
+            da_append(nls, (uint32_t) i);
+        }
+    }
+}
+
+#ifdef LINE_INDEX_AVX2
+// Scans the text 32 bytes at a time. Returns how much of it was scanned.
+#ifdef LINE_INDEX_AVX2_DISPATCH
+__attribute__((target("avx2")))
+#endif
+static size_t newlines_scan_avx2(Newlines *nls, const char *text, size_t text_len)
+{
+    size_t i = 0;
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; i + 32 <= text_len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (text + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, nl));
+        while (mask != 0) {
+            da_append(nls, (uint32_t) (i + count_trailing_zeros(mask)));
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+
+static bool newlines_avx2_supported(void)
+{
+#ifdef LINE_INDEX_AVX2_DISPATCH
+    return __builtin_cpu_supports("avx2");
+#else
+    return true;
+#endif
+}
+#endif
+
+void newlines_scan(Newlines *nls, const char *text, size_t text_len)
+{
+    assert(text_len <= LINE_INDEX_MAX_CHUNK);
+    size_t i = 0;
+#ifdef LINE_INDEX_AVX2
+    if (newlines_avx2_supported()) i = newlines_scan_avx2(nls, text, text_len);
+#endif
+#ifdef LINE_INDEX_SSE2
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= text_len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (text + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, nl));
+        while (mask != 0) {
+            da_append(nls, (uint32_t) (i + count_trailing_zeros(mask)));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < text_len; ++i) {
+        if (text[i] == '\n') {
+            da_append(nls, (uint32_t) i);
+        }
+    }
+}
+
+void line_index_build_from_chunks(Line_Index *li, const char *text, size_t text_len, Newlines_Chunk *chunks, size_t chunks_count)
+{
+    for (size_t i = 0; i < li->nodes.count; ++i) {
+        compact_tokens_free(&li->nodes.items[i].tokens);
+    }
+    li->nodes.count = 0;
+    li->root = 0;
+    li->free_list = 0;
+
+    size_t lines_count = 1;
+    for (size_t i = 0; i < chunks_count; ++i) {
+        lines_count += chunks[i].newlines.count;
+    }
+    if (li->nodes.capacity < lines_count + 1) {
+        li->nodes.capacity = lines_count + 1;
+        li->nodes.items = realloc(li->nodes.items, li->nodes.capacity*sizeof(*li->nodes.items));
+        assert(li->nodes.items != NULL && "Buy more RAM lol");
+    }
+
+    size_t begin = 0;
+    for (size_t i = 0; i < chunks_count; ++i) {
+        size_t base = chunks[i].text - text;
+        for (size_t j = 0; j < chunks[i].newlines.count; ++j) {
+            size_t end = base + chunks[i].newlines.items[j] + 1;
+            line_index_push(li, end - begin);
+            begin = end;
+        }
+        free(chunks[i].newlines.items);
+        chunks[i].newlines = (Newlines) {0};
+    }
+    line_index_push(li, text_len - begin);
+
+    li->root = line_index_pop_all(li);
+}
+
+void line_index_build(Line_Index *li, const char *text, size_t text_len)
+{
+    size_t chunks_count = text_len / LINE_INDEX_MAX_CHUNK + 1;
+    Newlines_Chunk *chunks = calloc(chunks_count, sizeof(*chunks));
+    assert(chunks != NULL && "Buy more RAM lol");
+    for (size_t i = 0; i < chunks_count; ++i) {
+        chunks[i].text = text + i*LINE_INDEX_MAX_CHUNK;
+        chunks[i].text_len = i + 1 < chunks_count ? LINE_INDEX_MAX_CHUNK : text_len - i*LINE_INDEX_MAX_CHUNK;
+        newlines_scan(&chunks[i].newlines, chunks[i].text, chunks[i].text_len);
+    }
+    line_index_build_from_chunks(li, text, text_len, chunks, chunks_count);
+    free(chunks);
+}
+
+size_t line_index_count(const Line_Index *li)
+{
+    if (li->root == 0) return 1;
+    return li->nodes.items[li->root].subtree_lines;
+}
+
+Line line_index_line(const Line_Index *li, size_t row)
+{
+    Line line = {0};
+    if (li->root == 0) return line;
+
+    size_t lines_count = line_index_count(li);
+    assert(row < lines_count);
+    size_t node = line_index_find_row(li, row, &line.begin);
+    line.end = line.begin + li->nodes.items[node].count;
+    if (row + 1 < lines_count) {
+        // Skipping the '\n'. Only the last line does not have one.
+        line.end -= 1;
+    }
+    return line;
+}
+
+size_t line_index_row(const Line_Index *li, size_t pos)
+{
+    size_t row = 0;
+    size_t node = li->root;
+    while (node != 0) {
+        const Line_Node *n = &li->nodes.items[node];
+        const Line_Node *l = &li->nodes.items[n->left];
+        if (pos < l->subtree_count) {
+            node = n->left;
+        } else if (pos < l->subtree_count + n->count) {
+            return row + l->subtree_lines;
+        } else {
+            pos -= l->subtree_count + n->count;
+            row += l->subtree_lines + 1;
+            node = n->right;
+        }
+    }
+    return line_index_count(li) - 1;
+}
+
+void line_index_insert(Line_Index *li, size_t pos, const char *text, size_t text_len)
+{
+    if (text_len == 0) return;
+    line_index_ensure(li);
+
+    size_t row = line_index_row(li, pos);
+    size_t begin;
+    size_t count = li->nodes.items[line_index_find_row(li, row, &begin)].count;
+    size_t col = pos - begin;
+
+    if (memchr(text, '\n', text_len) == NULL) {
+        line_index_resize(li, row, count + text_len);
+        return;
+    }
+
+    size_t left, middle, right;
+    line_index_split(li, li->root, row, &left, &middle);
+    line_index_split(li, middle, 1, &middle, &right);
+    Lexer_State lexer_state = li->nodes.items[middle].lexer_state;
+    line_index_release(li, middle);
+
+    size_t first = 0;
+    size_t prefix = col;
+    size_t line_begin = 0;
+    for (size_t i = 0; i < text_len; ++i) {
+        if (text[i] == '\n') {
+            size_t node = line_index_push(li, prefix + i + 1 - line_begin);
+            if (first == 0) first = node;
+            prefix = 0;
+            line_begin = i + 1;
+        }
+    }
+    line_index_push(li, text_len - line_begin + count - col);
+    // The line still begins where it used to, so does the lexer state there
+    li->nodes.items[first].lexer_state = lexer_state;
+    middle = line_index_pop_all(li);
+
+    li->root = line_index_merge(li, line_index_merge(li, left, middle), right);
+}
+
+void line_index_delete(Line_Index *li, size_t pos, size_t count)
+{
+    if (count == 0) return;
+    line_index_ensure(li);
+
+    size_t first = line_index_row(li, pos);
+    size_t last = line_index_row(li, pos + count);
+    size_t first_begin, last_begin;
+    line_index_find_row(li, first, &first_begin);
+    size_t last_count = li->nodes.items[line_index_find_row(li, last, &last_begin)].count;
+    size_t new_count = (pos - first_begin) + (last_begin + last_count - (pos + count));
+
+    if (first == last) {
+        line_index_resize(li, first, new_count);
+        return;
+    }
+
+    Lexer_State lexer_state = line_index_node(li, first)->lexer_state;
+    size_t left, middle, right;
+    line_index_split(li, li->root, first, &left, &middle);
+    line_index_split(li, middle, last - first + 1, &middle, &right);
+    line_index_release(li, middle);
+    middle = line_index_alloc(li, new_count);
+    li->nodes.items[middle].lexer_state = lexer_state;
+    li->root = line_index_merge(li, line_index_merge(li, left, middle), right);
+}
+
+static bool line_index_find_dirty(const Line_Index *li, size_t node, size_t row, size_t *dirty_row)
+{
+    const Line_Node *n = &li->nodes.items[node];
+    if (node == 0 || n->subtree_dirty == 0) return false;
+
+    size_t left_lines = li->nodes.items[n->left].subtree_lines;
+    if (row < left_lines && line_index_find_dirty(li, n->left, row, dirty_row)) {
+        return true;
+    }
+    if (row <= left_lines && n->dirty) {
+        *dirty_row = left_lines;
+        return true;
+    }
+    size_t skip = left_lines + 1;
+    if (line_index_find_dirty(li, n->right, row > skip ? row - skip : 0, dirty_row)) {
+        *dirty_row += skip;
+        return true;
+    }
+    return false;
+}
+
+bool line_index_next_dirty(Line_Index *li, size_t row, size_t *dirty_row)
+{
+    line_index_ensure(li);
+    return line_index_find_dirty(li, li->root, row, dirty_row);
+}
+
+Line_Node *line_index_node(Line_Index *li, size_t row)
+{
+    line_index_ensure(li);
+    assert(row < line_index_count(li));
+    size_t begin;
+    return &li->nodes.items[line_index_find_row(li, row, &begin)];
+}
+
+void line_index_clean(Line_Index *li, size_t row)
+{
+    if (!line_index_node(li, row)->dirty) return;
+
+    size_t node = li->root;
+    while (node != 0) {
+        Line_Node *n = &li->nodes.items[node];
+        size_t left_lines = li->nodes.items[n->left].subtree_lines;
+        n->subtree_dirty -= 1;
+        if (row < left_lines) {
+            node = n->left;
+        } else if (row == left_lines) {
+            n->dirty = false;
+            return;
+        } else {
+            row -= left_lines + 1;
+            node = n->right;
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef LINE_INDEX_H_
+#define LINE_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "./lexer.h"
+
+// Lines of the text stored in a treap keyed implicitly by the row. Every node knows the amount of
+// bytes and lines in its subtree, so both offset -> row and row -> offset lookups cost O(log lines).
+// Edits patch only the lines they touch instead of rescanning the whole text.
+//
+// The text with N newlines always has N + 1 lines. An empty index is a single empty line.
+//
+// Every line also caches its tokens together with the state of the lexer at its beginning. Lines
+// touched by the edits are marked dirty, so only they (and the lines after them whose starting
+// state has changed) have to be lexed again.
+
+typedef struct {
+    size_t begin;
+    size_t end;
+} Line;
+
+typedef struct {
+    size_t left;
+    size_t right;
+    uint32_t priority;
+
+    size_t count; // the length of the line including the trailing '\n'
+    size_t subtree_count;
+    size_t subtree_lines;
+
+    bool dirty;
+    size_t subtree_dirty;
+    Lexer_State lexer_state;
+    Compact_Tokens tokens; // offsets of the tokens are relative to the beginning of the line
+    uint64_t version;      // changes every time the line is lexed, see Line_Index.versions
+} Line_Node;
+
+typedef struct {
+    Line_Node *items;
+    size_t count;
+    size_t capacity;
+} Line_Nodes;
+
+typedef struct {
+    size_t *items;
+    size_t count;
+    size_t capacity;
+} Line_Index_Stack;
+
+typedef struct {
+    Line_Nodes nodes;
+    size_t root;
+    size_t free_list; // released nodes linked through Line_Node.left
+    uint32_t seed;
+    Line_Index_Stack stack;
+    // The last version handed out to a lexed line. It is never reset, not even by line_index_build(),
+    // so a version uniquely identifies the contents and the tokens of a line for as long as the index
+    // lives. Anything derived from a line, like its geometry, can be cached by it.
+    uint64_t versions;
+} Line_Index;
+
+// Offsets of the '\n'-s relative to the beginning of the scanned text
+typedef struct {
+    uint32_t *items;
+    size_t count;
+    size_t capacity;
+} Newlines;
+
+// Newlines are stored as 32 bit offsets, so the scanned chunks must not be bigger than that
+#define LINE_INDEX_MAX_CHUNK ((size_t) 1 << 31)
+
+void newlines_scan_scalar(Newlines *nls, const char *text, size_t text_len);
+// Vectorized with AVX2 when the CPU supports it, with SSE2 or scalar otherwise.
+void newlines_scan(Newlines *nls, const char *text, size_t text_len);
+
+// A piece of the text together with its newlines
+typedef struct {
+    const char *text;
+    size_t text_len;
+    Newlines newlines;
+} Newlines_Chunk;
+
+// Scans the whole text on the current thread. See line_index_build_parallel() for the large texts.
+void line_index_build(Line_Index *li, const char *text, size_t text_len);
+// Builds the index out of the chunks that are already scanned. They must cover the whole text in
+// order. Their newlines are freed.
+void line_index_build_from_chunks(Line_Index *li, const char *text, size_t text_len, Newlines_Chunk *chunks, size_t chunks_count);
+size_t line_index_count(const Line_Index *li);
+Line line_index_line(const Line_Index *li, size_t row);
+size_t line_index_row(const Line_Index *li, size_t pos);
+void line_index_insert(Line_Index *li, size_t pos, const char *text, size_t text_len);
+void line_index_delete(Line_Index *li, size_t pos, size_t count);
+
+// The first dirty row starting from `row`
+bool line_index_next_dirty(Line_Index *li, size_t row, size_t *dirty_row);
+Line_Node *line_index_node(Line_Index *li, size_t row);
+void line_index_clean(Line_Index *li, size_t row);
+
+#endif // LINE_INDEX_H_
@@ -0,0 +1,56 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include <SDL2/SDL.h>
+
+#include "./line_index_parallel.h"
+
+#define LINE_INDEX_PARALLEL_THRESHOLD (4*1024*1024)
+
+static int newlines_job(void *data)
+{
+    Newlines_Chunk *chunk = data;
+    newlines_scan(&chunk->newlines, chunk->text, chunk->text_len);
+    return 0;
+}
+
+void line_index_build_parallel(Line_Index *li, const char *text, size_t text_len)
+{
+    size_t jobs_count = 1;
+    if (text_len >= LINE_INDEX_PARALLEL_THRESHOLD) {
+        int cpus = SDL_GetCPUCount();
+        if (cpus > 1) jobs_count = cpus;
+    }
+    while (text_len / jobs_count >= LINE_INDEX_MAX_CHUNK) {
+        jobs_count += 1;
+    }
+
+    Newlines_Chunk *jobs = calloc(jobs_count, sizeof(*jobs));
+    SDL_Thread **threads = calloc(jobs_count, sizeof(*threads));
+    assert(jobs != NULL && threads != NULL && "Buy more RAM lol");
+
+    size_t chunk_len = text_len / jobs_count;
+    for (size_t i = 0; i < jobs_count; ++i) {
+        jobs[i].text = text + i*chunk_len;
+        jobs[i].text_len = i + 1 < jobs_count ? chunk_len : text_len - i*chunk_len;
+    }
+
+    // The first chunk is scanned on the current thread. If a thread could not be created its chunk
+    // is scanned on the current thread too.
+    for (size_t i = 1; i < jobs_count; ++i) {
+        threads[i] = SDL_CreateThread(newlines_job, "newlines", &jobs[i]);
+    }
+    newlines_job(&jobs[0]);
+    for (size_t i = 1; i < jobs_count; ++i) {
+        if (threads[i] != NULL) {
+            SDL_WaitThread(threads[i], NULL);
+        } else {
+            newlines_job(&jobs[i]);
+        }
+    }
+
+    line_index_build_from_chunks(li, text, text_len, jobs, jobs_count);
+
+    free(threads);
+    free(jobs);
+}
@@ -0,0 +1,10 @@
+#ifndef LINE_INDEX_PARALLEL_H_
+#define LINE_INDEX_PARALLEL_H_
+
+#include "./line_index.h"
+
+// Same as line_index_build(), but the large texts are split into chunks that are scanned for
+// newlines on SDL threads. Kept apart, so the line index itself does not depend on SDL.
+void line_index_build_parallel(Line_Index *li, const char *text, size_t text_len);
+
+#endif // LINE_INDEX_PARALLEL_H_
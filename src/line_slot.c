@@ -0,0 +1,20 @@
+#include "./line_slot.h"
+
+bool line_slot_reusable(const Line_Slot *slot, size_t row, uint64_t version, float max_x)
+{
+    return slot->valid && slot->row == row && slot->version == version &&
+           (!slot->truncated || slot->max_x >= max_x);
+}
+
+void line_slot_store(Line_Slot *slot, bool valid, size_t row, uint64_t version,
+                     size_t laid_out, size_t tokens_count, float len, float max_x)
+{
+    slot->valid = valid;
+    slot->row = row;
+    slot->version = version;
+    // NOTE: the last laid out token is clipped at max_x too. A long trailing comment is laid out
+    // entirely, but only its beginning gets into the slot.
+    slot->truncated = laid_out < tokens_count || len > max_x;
+    slot->max_x = max_x;
+    slot->len = len;
+}
@@ -0,0 +1,25 @@
+#ifndef LINE_SLOT_H_
+#define LINE_SLOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// What the slot of the geometry cache of the renderer holds for a line, see editor_render()
+typedef struct {
+    bool valid;
+    size_t row;
+    uint64_t version; // Line_Node.version
+    bool truncated;   // the geometry stops at max_x, the rest of the line is not in the slot
+    float max_x;
+    float len;        // the end of the laid out part of the line
+} Line_Slot;
+
+// Whether the slot still has the geometry of the line when it is laid out up to max_x
+bool line_slot_reusable(const Line_Slot *slot, size_t row, uint64_t version, float max_x);
+// Records the line that was just laid out into the slot. laid_out of the tokens_count tokens of the
+// line were laid out and the last of them ends at len. The geometry was clipped at max_x.
+void line_slot_store(Line_Slot *slot, bool valid, size_t row, uint64_t version,
+                     size_t laid_out, size_t tokens_count, float len, float max_x);
+
+#endif // LINE_SLOT_H_
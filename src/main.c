@@ -52,12 +52,49 @@ static Simple_Renderer sr = {0};
 static Editor editor = {0};
 static File_Browser fb = {0};
 
+#define GL_STATS_FRAMES 60
+#define LATENCY_STATS_SAMPLES 200
+
+// Milliseconds from the keystroke to the swap that presented it
+typedef struct {
+    Uint32 *items;
+    size_t count;
+    size_t capacity;
+} Latencies;
+
+static int compare_latencies(const void *a, const void *b)
+{
+    Uint32 x = *(const Uint32 *) a;
+    Uint32 y = *(const Uint32 *) b;
+    return (x > y) - (x < y);
+}
+
+static void latencies_report(Latencies *latencies)
+{
+    if (latencies->count == 0) return;
+    qsort(latencies->items, latencies->count, sizeof(*latencies->items), compare_latencies);
+    size_t n = latencies->count;
+    printf("Keystroke to present latency over %zu keystrokes: p50 %u ms, p99 %u ms, max %u ms\n",
+           n, latencies->items[n*50/100], latencies->items[n*99/100], latencies->items[n - 1]);
+    latencies->count = 0;
+}
+
 // TODO: display errors reported via flash_error right in the text editor window somehow
 #define flash_error(...) do { fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); } while(0)
 
 
+static double seconds_since(Uint64 begin)
+{
+    return (double) (SDL_GetPerformanceCounter() - begin) / (double) SDL_GetPerformanceFrequency();
+}
+
 int main(int argc, char **argv)
 {
+    // Reports how long it takes from the start up to the first presented frame
+    const bool startup_stats = getenv("DED_STARTUP_STATS") != NULL;
+    const Uint64 startup_begin = SDL_GetPerformanceCounter();
+    bool started_up = false;
+
     Errno err;
 
     FT_Library library = {0};
@@ -154,17 +191,55 @@ int main(int argc, char **argv)
     }
 
     simple_renderer_init(&sr);
-    free_glyph_atlas_init(&atlas, face);
+    const Uint64 atlas_begin = SDL_GetPerformanceCounter();
+    free_glyph_atlas_init(&atlas, face, font_file_path);
+    if (startup_stats) printf("Glyph atlas is ready in %.3f s\n", seconds_since(atlas_begin));
 
     editor.atlas = &atlas;
-    editor_retokenize(&editor);
+
+    // Reports the average amount of GL calls made by the renderer per frame
+    const bool gl_stats = getenv("DED_GL_STATS") != NULL;
+    size_t gl_stats_frames = 0;
+
+    // Reports the latency from the keystrokes to the swaps that first present them
+    const bool latency_stats = getenv("DED_LATENCY") != NULL;
+    Latencies latencies = {0};
+    Latencies pending_keystrokes = {0}; // the timestamps of the keystrokes that are not presented yet
+
+    // Waits for the next frame in a way that is interrupted by the input, so the input is rendered
+    // right away instead of on the fixed cadence of FPS
+    const bool low_latency = getenv("DED_LOW_LATENCY") != NULL;
 
     bool quit = false;
     bool file_browser = false;
+    // The frame is rendered only if something on the screen could have changed since the last one
+    bool damaged = true;
+    bool cursor_visible = false;
     while (!quit) {
+        {
+            Uint32 flags = SDL_GetWindowFlags(window);
+            bool visible = !(flags & (SDL_WINDOW_HIDDEN | SDL_WINDOW_MINIMIZED));
+            // NOTE: the file browser is always animated by the epic shader
+            bool animating = visible && (file_browser || !simple_renderer_camera_settled(&sr));
+            if (!damaged && !animating) {
+                // Sleep until there is an event. The event itself stays in the queue for the loop below.
+                if (visible) {
+                    SDL_WaitEventTimeout(NULL, editor_cursor_next_blink(&editor, SDL_GetTicks()));
+                } else {
+                    SDL_WaitEvent(NULL);
+                }
+            }
+            damaged = damaged || animating;
+        }
+
         const Uint32 start = SDL_GetTicks();
         SDL_Event event = {0};
         while (SDL_PollEvent(&event)) {
+            damaged = true;
+            // NOTE: every keystroke is a SDL_KEYDOWN, even the ones that also produce SDL_TEXTINPUT
+            if (latency_stats && event.type == SDL_KEYDOWN) {
+                da_append(&pending_keystrokes, event.common.timestamp);
+            }
             switch (event.type) {
             case SDL_QUIT: {
                 quit = true;
@@ -315,7 +390,7 @@ int main(int argc, char **argv)
                         if (event.key.keysym.mod & KMOD_CTRL) {
                             editor.selection = true;
                             editor.select_begin = 0;
-                            editor.cursor = editor.data.count;
+                            editor.cursor = piece_table_count(&editor.data);
                         }
                     }
                     break;
@@ -328,9 +403,7 @@ int main(int argc, char **argv)
                         // - tabs/spaces
                         // - tab width
                         // - etc.
-                        for (size_t i = 0; i < 4; ++i) {
-                            editor_insert_char(&editor, ' ');
-                        }
+                        editor_insert_buf(&editor, "    ", 4);
                     }
                     break;
 
@@ -403,9 +476,7 @@ int main(int argc, char **argv)
                 } else {
                     const char *text = event.text.text;
                     size_t text_len = strlen(text);
-                    for (size_t i = 0; i < text_len; ++i) {
-                        editor_insert_char(&editor, text[i]);
-                    }
+                    editor_insert_buf(&editor, text, text_len);
                     editor.last_stroke = SDL_GetTicks();
                 }
             }
@@ -413,6 +484,13 @@ int main(int argc, char **argv)
             }
         }
 
+        if (!file_browser && editor_cursor_visible(&editor, start) != cursor_visible) {
+            damaged = true;
+        }
+        if (!damaged) continue;
+        damaged = false;
+        cursor_visible = editor_cursor_visible(&editor, start);
+
         {
             int w, h;
             SDL_GetWindowSize(window, &w, &h);
@@ -424,6 +502,7 @@ int main(int argc, char **argv)
         glClearColor(bg.x, bg.y, bg.z, bg.w);
         glClear(GL_COLOR_BUFFER_BIT);
 
+        free_glyph_atlas_begin_frame(&atlas);
         if (file_browser) {
             fb_render(&fb, window, &atlas, &sr);
         } else {
@@ -432,13 +511,45 @@ int main(int argc, char **argv)
 
         SDL_GL_SwapWindow(window);
 
+        if (startup_stats && !started_up) {
+            printf("Started up in %.3f s\n", seconds_since(startup_begin));
+            started_up = true;
+        }
+
+        if (latency_stats) {
+            Uint32 presented = SDL_GetTicks();
+            for (size_t i = 0; i < pending_keystrokes.count; ++i) {
+                da_append(&latencies, presented - pending_keystrokes.items[i]);
+            }
+            pending_keystrokes.count = 0;
+            if (latencies.count >= LATENCY_STATS_SAMPLES) latencies_report(&latencies);
+        }
+
+        if (gl_stats) {
+            gl_stats_frames += 1;
+            if (gl_stats_frames >= GL_STATS_FRAMES) {
+                double n = (double) gl_stats_frames;
+                printf("GL calls per frame: use_program %.1f, get_uniform_location %.1f, uniform %.1f, buffer_upload %.1f, draw %.1f\n",
+                       sr.stats.use_program/n, sr.stats.get_uniform_location/n, sr.stats.uniform/n,
+                       sr.stats.buffer_upload/n, sr.stats.draw/n);
+                sr.stats = (Simple_Renderer_Stats) {0};
+                gl_stats_frames = 0;
+            }
+        }
+
         const Uint32 duration = SDL_GetTicks() - start;
         const Uint32 delta_time_ms = 1000 / FPS;
         if (duration < delta_time_ms) {
-            SDL_Delay(delta_time_ms - duration);
+            if (low_latency) {
+                SDL_WaitEventTimeout(NULL, delta_time_ms - duration);
+            } else {
+                SDL_Delay(delta_time_ms - duration);
+            }
         }
     }
 
+    if (latency_stats) latencies_report(&latencies);
+
     return 0;
 }
 
@@ -0,0 +1,261 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "./piece_table.h"
+
+static uint32_t piece_table_random(Piece_Table *pt)
+{
+    // xorshift32
+    if (pt->seed == 0) pt->seed = 0x9E3779B9;
+    uint32_t x = pt->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pt->seed = x;
+    return x;
+}
+
+static void piece_table_update(Piece_Table *pt, size_t node)
+{
+    Piece *p = &pt->pieces.items[node];
+    p->subtree_count = pt->pieces.items[p->left].subtree_count + p->count + pt->pieces.items[p->right].subtree_count;
+}
+
+static size_t piece_table_alloc(Piece_Table *pt, Piece_Source source, size_t begin, size_t count, uint32_t priority)
+{
+    if (pt->pieces.count == 0) {
+        Piece nil = {0};
+        da_append(&pt->pieces, nil);
+    }
+
+    size_t node;
+    if (pt->free_list != 0) {
+        node = pt->free_list;
+        pt->free_list = pt->pieces.items[node].left;
+    } else {
+        node = pt->pieces.count;
+        Piece piece = {0};
+        da_append(&pt->pieces, piece);
+    }
+
+    Piece *p = &pt->pieces.items[node];
+    p->source = source;
+    p->begin = begin;
+    p->count = count;
+    p->left = 0;
+    p->right = 0;
+    p->priority = priority;
+    p->subtree_count = count;
+    return node;
+}
+
+static void piece_table_release(Piece_Table *pt, size_t node)
+{
+    if (node == 0) return;
+    piece_table_release(pt, pt->pieces.items[node].left);
+    piece_table_release(pt, pt->pieces.items[node].right);
+    pt->pieces.items[node].left = pt->free_list;
+    pt->free_list = node;
+}
+
+// Splits the tree into [0, pos) and [pos, count). The piece that straddles pos is cut in two.
+static void piece_table_split(Piece_Table *pt, size_t node, size_t pos, size_t *left, size_t *right)
+{
+    if (node == 0) {
+        *left = 0;
+        *right = 0;
+        return;
+    }
+
+    size_t left_count = pt->pieces.items[pt->pieces.items[node].left].subtree_count;
+    size_t count = pt->pieces.items[node].count;
+
+    if (pos <= left_count) {
+        size_t l, r;
+        piece_table_split(pt, pt->pieces.items[node].left, pos, &l, &r);
+        pt->pieces.items[node].left = r;
+        piece_table_update(pt, node);
+        *left = l;
+        *right = node;
+    } else if (pos >= left_count + count) {
+        size_t l, r;
+        piece_table_split(pt, pt->pieces.items[node].right, pos - left_count - count, &l, &r);
+        pt->pieces.items[node].right = l;
+        piece_table_update(pt, node);
+        *left = node;
+        *right = r;
+    } else {
+        size_t k = pos - left_count;
+        Piece p = pt->pieces.items[node];
+        // NOTE: the tail inherits the priority of the piece, so it can adopt the right subtree
+        // without breaking the heap order.
+        size_t tail = piece_table_alloc(pt, p.source, p.begin + k, p.count - k, p.priority);
+        pt->pieces.items[tail].right = p.right;
+        piece_table_update(pt, tail);
+        pt->pieces.items[node].count = k;
+        pt->pieces.items[node].right = 0;
+        piece_table_update(pt, node);
+        *left = node;
+        *right = tail;
+    }
+}
+
+static size_t piece_table_merge(Piece_Table *pt, size_t left, size_t right)
+{
+    if (left == 0) return right;
+    if (right == 0) return left;
+
+    if (pt->pieces.items[left].priority >= pt->pieces.items[right].priority) {
+        size_t merged = piece_table_merge(pt, pt->pieces.items[left].right, right);
+        pt->pieces.items[left].right = merged;
+        piece_table_update(pt, left);
+        return left;
+    } else {
+        size_t merged = piece_table_merge(pt, left, pt->pieces.items[right].left);
+        pt->pieces.items[right].left = merged;
+        piece_table_update(pt, right);
+        return right;
+    }
+}
+
+static const char *piece_table_data(const Piece_Table *pt, const Piece *p)
+{
+    switch (p->source) {
+    case PIECE_ORIGINAL:
+        return pt->original.items + p->begin;
+    case PIECE_ADD:
+        return pt->add.items + p->begin;
+    default:
+        UNREACHABLE("piece_table_data");
+    }
+    return NULL;
+}
+
+Errno piece_table_load_from_file(Piece_Table *pt, const char *file_path)
+{
+    String_Builder original = {0};
+    Errno err = read_entire_file(file_path, &original);
+    if (err != 0) {
+        free(original.items);
+        return err;
+    }
+
+    free(pt->original.items);
+    pt->original = original;
+    pt->add.count = 0;
+    pt->pieces.count = 0;
+    pt->root = 0;
+    pt->free_list = 0;
+    if (pt->original.count > 0) {
+        pt->root = piece_table_alloc(pt, PIECE_ORIGINAL, 0, pt->original.count, piece_table_random(pt));
+    }
+
+    return 0;
+}
+
+Errno piece_table_save_to_file(const Piece_Table *pt, const char *file_path)
+{
+    Errno result = 0;
+    FILE *f = NULL;
+
+    f = fopen(file_path, "wb");
+    if (f == NULL) return_defer(errno);
+
+    size_t count = piece_table_count(pt);
+    for (size_t pos = 0; pos < count;) {
+        String_View chunk = piece_table_chunk(pt, pos);
+        fwrite(chunk.data, 1, chunk.count, f);
+        if (ferror(f)) return_defer(errno);
+        pos += chunk.count;
+    }
+
+defer:
+    if (f) fclose(f);
+    return result;
+}
+
+size_t piece_table_count(const Piece_Table *pt)
+{
+    if (pt->root == 0) return 0;
+    return pt->pieces.items[pt->root].subtree_count;
+}
+
+String_View piece_table_chunk(const Piece_Table *pt, size_t pos)
+{
+    size_t node = pt->root;
+    while (node != 0) {
+        const Piece *p = &pt->pieces.items[node];
+        size_t left_count = pt->pieces.items[p->left].subtree_count;
+        if (pos < left_count) {
+            node = p->left;
+        } else if (pos < left_count + p->count) {
+            size_t offset = pos - left_count;
+            return sv_from_parts(piece_table_data(pt, p) + offset, p->count - offset);
+        } else {
+            pos -= left_count + p->count;
+            node = p->right;
+        }
+    }
+    return sv_from_parts(NULL, 0);
+}
+
+char piece_table_char_at(const Piece_Table *pt, size_t pos)
+{
+    String_View chunk = piece_table_chunk(pt, pos);
+    assert(chunk.count > 0);
+    return chunk.data[0];
+}
+
+void piece_table_read(const Piece_Table *pt, size_t begin, size_t count, String_Builder *sb)
+{
+    assert(begin + count <= piece_table_count(pt));
+    while (count > 0) {
+        String_View chunk = piece_table_chunk(pt, begin);
+        size_t n = chunk.count < count ? chunk.count : count;
+        sb_append_buf(sb, chunk.data, n);
+        begin += n;
+        count -= n;
+    }
+}
+
+void piece_table_insert(Piece_Table *pt, size_t pos, const char *buf, size_t buf_len)
+{
+    if (buf_len == 0) return;
+    assert(pos <= piece_table_count(pt));
+
+    size_t add_begin = pt->add.count;
+    sb_append_buf(&pt->add, buf, buf_len);
+
+    size_t left, right;
+    piece_table_split(pt, pt->root, pos, &left, &right);
+
+    // Typing usually continues right where the previous insertion ended. In that case the last
+    // piece on the left is simply extended instead of creating a new one for every keystroke.
+    size_t last = left;
+    while (last != 0 && pt->pieces.items[last].right != 0) {
+        last = pt->pieces.items[last].right;
+    }
+    if (last != 0 && pt->pieces.items[last].source == PIECE_ADD && pt->pieces.items[last].begin + pt->pieces.items[last].count == add_begin) {
+        for (size_t node = left; node != 0; node = pt->pieces.items[node].right) {
+            pt->pieces.items[node].subtree_count += buf_len;
+        }
+        pt->pieces.items[last].count += buf_len;
+        pt->root = piece_table_merge(pt, left, right);
+    } else {
+        size_t node = piece_table_alloc(pt, PIECE_ADD, add_begin, buf_len, piece_table_random(pt));
+        pt->root = piece_table_merge(pt, piece_table_merge(pt, left, node), right);
+    }
+}
+
+void piece_table_delete(Piece_Table *pt, size_t pos, size_t count)
+{
+    if (count == 0) return;
+    assert(pos + count <= piece_table_count(pt));
+
+    size_t left, middle, right;
+    piece_table_split(pt, pt->root, pos, &left, &middle);
+    piece_table_split(pt, middle, count, &middle, &right);
+    piece_table_release(pt, middle);
+    pt->root = piece_table_merge(pt, left, right);
+}
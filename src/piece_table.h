@@ -0,0 +1,58 @@
+#ifndef PIECE_TABLE_H_
+#define PIECE_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "./common.h"
+#include "./sv.h"
+
+// https://en.wikipedia.org/wiki/Piece_table
+//
+// The original content of the file is never modified or copied. Everything that is inserted is
+// appended to the add buffer. The text itself is the concatenation of the pieces in the order they
+// appear in the treap which is keyed implicitly by the offset of the piece within the text. So
+// locating, inserting and deleting costs O(log pieces) regardless of the size of the text.
+
+typedef enum {
+    PIECE_ORIGINAL = 0,
+    PIECE_ADD,
+} Piece_Source;
+
+typedef struct {
+    Piece_Source source;
+    size_t begin;
+    size_t count;
+
+    // Treap bookkeeping. Children are indices into Pieces. The index 0 is reserved for the nil node.
+    size_t left;
+    size_t right;
+    uint32_t priority;
+    size_t subtree_count;
+} Piece;
+
+typedef struct {
+    Piece *items;
+    size_t count;
+    size_t capacity;
+} Pieces;
+
+typedef struct {
+    String_Builder original;
+    String_Builder add;
+    Pieces pieces;
+    size_t root;
+    size_t free_list; // released nodes linked through Piece.left
+    uint32_t seed;
+} Piece_Table;
+
+Errno piece_table_load_from_file(Piece_Table *pt, const char *file_path);
+Errno piece_table_save_to_file(const Piece_Table *pt, const char *file_path);
+size_t piece_table_count(const Piece_Table *pt);
+char piece_table_char_at(const Piece_Table *pt, size_t pos);
+// The longest contiguous run of the text that starts at pos. Empty if pos is at the end of the text.
+String_View piece_table_chunk(const Piece_Table *pt, size_t pos);
+void piece_table_read(const Piece_Table *pt, size_t begin, size_t count, String_Builder *sb);
+void piece_table_insert(Piece_Table *pt, size_t pos, const char *buf, size_t buf_len);
+void piece_table_delete(Piece_Table *pt, size_t pos, size_t count);
+
+#endif // PIECE_TABLE_H_
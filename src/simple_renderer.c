@@ -4,18 +4,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
 #include "./simple_renderer.h"
 #include "./common.h"
 
 #define vert_shader_file_path "./shaders/simple.vert"
+#define instance_vert_shader_file_path "./shaders/instance.vert"
+#define frag_shader_file_path "./shaders/simple.frag"
 
-static_assert(COUNT_SIMPLE_SHADERS == 4, "The amount of fragment shaders has changed");
-const char *frag_shader_file_paths[COUNT_SIMPLE_SHADERS] = {
-    [SHADER_FOR_COLOR] = "./shaders/simple_color.frag",
-    [SHADER_FOR_IMAGE] = "./shaders/simple_image.frag",
-    [SHADER_FOR_TEXT] = "./shaders/simple_text.frag",
-    [SHADER_FOR_EPICNESS] = "./shaders/simple_epic.frag",
-};
+static_assert(COUNT_SIMPLE_SHADERS == 4, "The amount of shaders has changed. Please update shaders/simple.frag accordingly");
 
 static const char *shader_type_as_cstr(GLuint shader)
 {
@@ -100,7 +97,7 @@ typedef struct {
     const char *name;
 } Uniform_Def;
 
-static_assert(COUNT_UNIFORM_SLOTS == 4, "The amount of the shader uniforms have change. Please update the definition table accordingly");
+static_assert(COUNT_UNIFORM_SLOTS == 5, "The amount of the shader uniforms have change. Please update the definition table accordingly");
 static const Uniform_Def uniform_defs[COUNT_UNIFORM_SLOTS] = {
     [UNIFORM_SLOT_TIME] = {
         .slot = UNIFORM_SLOT_TIME,
@@ -118,6 +115,10 @@ static const Uniform_Def uniform_defs[COUNT_UNIFORM_SLOTS] = {
         .slot = UNIFORM_SLOT_CAMERA_SCALE,
         .name = "camera_scale",
     },
+    [UNIFORM_SLOT_SHADER] = {
+        .slot = UNIFORM_SLOT_SHADER,
+        .name = "shader",
+    },
 };
 
 
@@ -128,6 +129,165 @@ static void get_uniform_location(GLuint program, GLint locations[COUNT_UNIFORM_S
     }
 }
 
+// Links the fragment shader with the given vertex shader
+static bool load_program(Simple_Renderer *sr, const char *vert_file_path, Simple_Program *program)
+{
+    GLuint shaders[2] = {0};
+
+    bool ok = true;
+
+    if (!compile_shader_file(vert_file_path, GL_VERTEX_SHADER, &shaders[0])) {
+        ok = false;
+    }
+    if (!compile_shader_file(frag_shader_file_path, GL_FRAGMENT_SHADER, &shaders[1])) {
+        ok = false;
+    }
+
+    *program = (Simple_Program) {0};
+    program->id = glCreateProgram();
+    attach_shaders_to_program(shaders, sizeof(shaders) / sizeof(shaders[0]), program->id);
+    if (!link_program(program->id, __FILE__, __LINE__)) {
+        ok = false;
+    }
+    glDeleteShader(shaders[0]);
+    glDeleteShader(shaders[1]);
+
+    if (!ok) {
+        glDeleteProgram(program->id);
+        return false;
+    }
+
+    get_uniform_location(program->id, program->uniforms);
+    sr->stats.get_uniform_location += COUNT_UNIFORM_SLOTS;
+
+    glUseProgram(program->id);
+    glUniform1i(glGetUniformLocation(program->id, "image"), 0);
+    glUniform1i(glGetUniformLocation(program->id, "glyph_metrics"), SIMPLE_GLYPH_METRICS_TEXTURE_UNIT);
+    sr->stats.use_program += 1;
+    sr->stats.get_uniform_location += 2;
+    sr->stats.uniform += 2;
+    sr->bound_program = 0;
+    glUseProgram(0);
+
+    return true;
+}
+
+#define SIMPLE_STREAM_WAIT_TIMEOUT_NS 1000000000
+
+static void simple_stream_init(Simple_Stream *stream, size_t segment_size)
+{
+    stream->segment_size = segment_size;
+    GLsizeiptr size = SIMPLE_SEGMENTS_COUNT*segment_size;
+
+    glGenBuffers(1, &stream->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->vbo);
+
+    if (GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+        stream->mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+        if (stream->mapped == NULL) {
+            fprintf(stderr, "WARNING: could not map the stream buffer persistently. Falling back to orphaning.\n");
+            // The storage of the buffer is immutable now, so it has to be recreated
+            glDeleteBuffers(1, &stream->vbo);
+            glGenBuffers(1, &stream->vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, stream->vbo);
+        }
+    }
+
+    if (stream->mapped == NULL) {
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    }
+}
+
+// Uploads the data into the current segment of the stream which is expected to be bound to
+// GL_ARRAY_BUFFER. Returns the offset of the segment within the buffer.
+static size_t simple_stream_upload(Simple_Stream *stream, const void *data, size_t size)
+{
+    assert(size <= stream->segment_size);
+    size_t offset = stream->segment*stream->segment_size;
+
+    if (stream->mapped) {
+        GLsync fence = stream->fences[stream->segment];
+        if (fence) {
+            // NOTE: with SIMPLE_SEGMENTS_COUNT segments in flight this almost never actually waits
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, SIMPLE_STREAM_WAIT_TIMEOUT_NS) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fence);
+            stream->fences[stream->segment] = NULL;
+        }
+        memcpy((char *) stream->mapped + offset, data, size);
+    } else {
+        if (stream->segment == 0) {
+            // Orphaning. The driver hands out fresh storage while the old one stays alive until the
+            // draw calls that read from it are done.
+            glBufferData(GL_ARRAY_BUFFER, SIMPLE_SEGMENTS_COUNT*stream->segment_size, NULL, GL_STREAM_DRAW);
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+    }
+
+    return offset;
+}
+
+// Fences the draw calls issued from the current segment and moves on to the next one
+static void simple_stream_next(Simple_Stream *stream)
+{
+    if (stream->mapped) {
+        stream->fences[stream->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    stream->segment = (stream->segment + 1) % SIMPLE_SEGMENTS_COUNT;
+}
+
+// The instances are streamed through the same kind of segment ring as the verticies. Since the base
+// instance of the draw calls is not available in GL 3.3 the attributes are pointed at the segment
+// before each draw.
+static void instances_attrib_pointers(size_t base)
+{
+    glVertexAttribPointer(
+        SIMPLE_INSTANCE_ATTR_POSITION,
+        2,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(Simple_Instance),
+        (GLvoid *) (base + offsetof(Simple_Instance, position)));
+
+    glVertexAttribPointer(
+        SIMPLE_INSTANCE_ATTR_SIZE,
+        2,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(Simple_Instance),
+        (GLvoid *) (base + offsetof(Simple_Instance, size)));
+
+    glVertexAttribPointer(
+        SIMPLE_INSTANCE_ATTR_COLOR,
+        4,
+        GL_UNSIGNED_BYTE,
+        GL_TRUE,
+        sizeof(Simple_Instance),
+        (GLvoid *) (base + offsetof(Simple_Instance, color)));
+
+    glVertexAttribIPointer(
+        SIMPLE_INSTANCE_ATTR_GLYPH,
+        1,
+        GL_UNSIGNED_SHORT,
+        sizeof(Simple_Instance),
+        (GLvoid *) (base + offsetof(Simple_Instance, glyph)));
+
+    glVertexAttribIPointer(
+        SIMPLE_INSTANCE_ATTR_SHADER,
+        1,
+        GL_UNSIGNED_BYTE,
+        sizeof(Simple_Instance),
+        (GLvoid *) (base + offsetof(Simple_Instance, shader)));
+
+    glVertexAttribIPointer(
+        SIMPLE_INSTANCE_ATTR_KIND,
+        1,
+        GL_UNSIGNED_BYTE,
+        sizeof(Simple_Instance),
+        (GLvoid *) (base + offsetof(Simple_Instance, kind)));
+}
+
 void simple_renderer_init(Simple_Renderer *sr)
 {
     sr->camera_scale = 3.0f;
@@ -136,9 +296,7 @@ void simple_renderer_init(Simple_Renderer *sr)
         glGenVertexArrays(1, &sr->vao);
         glBindVertexArray(sr->vao);
 
-        glGenBuffers(1, &sr->vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, sr->vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(sr->verticies), sr->verticies, GL_DYNAMIC_DRAW);
+        simple_stream_init(&sr->verticies_stream, sizeof(sr->verticies));
 
         // position
         glEnableVertexAttribArray(SIMPLE_VERTEX_ATTR_POSITION);
@@ -155,8 +313,8 @@ void simple_renderer_init(Simple_Renderer *sr)
         glVertexAttribPointer(
             SIMPLE_VERTEX_ATTR_COLOR,
             4,
-            GL_FLOAT,
-            GL_FALSE,
+            GL_UNSIGNED_BYTE,
+            GL_TRUE,
             sizeof(Simple_Vertex),
             (GLvoid *) offsetof(Simple_Vertex, color));
 
@@ -165,98 +323,84 @@ void simple_renderer_init(Simple_Renderer *sr)
         glVertexAttribPointer(
             SIMPLE_VERTEX_ATTR_UV,
             2,
-            GL_FLOAT,
-            GL_FALSE,
+            GL_UNSIGNED_SHORT,
+            GL_TRUE,
             sizeof(Simple_Vertex),
             (GLvoid *) offsetof(Simple_Vertex, uv));
     }
 
-    GLuint shaders[2] = {0};
+    {
+        glGenVertexArrays(1, &sr->instances_vao);
+        glBindVertexArray(sr->instances_vao);
 
-    if (!compile_shader_file(vert_shader_file_path, GL_VERTEX_SHADER, &shaders[0])) {
-        exit(1);
-    }
+        simple_stream_init(&sr->instances_stream, sizeof(sr->instances));
 
-    for (int i = 0; i < COUNT_SIMPLE_SHADERS; ++i) {
-        if (!compile_shader_file(frag_shader_file_paths[i], GL_FRAGMENT_SHADER, &shaders[1])) {
-            exit(1);
+        for (Simple_Instance_Attr attr = SIMPLE_INSTANCE_ATTR_POSITION; attr <= SIMPLE_INSTANCE_ATTR_KIND; ++attr) {
+            glEnableVertexAttribArray(attr);
+            glVertexAttribDivisor(attr, 1);
         }
-        sr->programs[i] = glCreateProgram();
-        attach_shaders_to_program(shaders, sizeof(shaders) / sizeof(shaders[0]), sr->programs[i]);
-        if (!link_program(sr->programs[i], __FILE__, __LINE__)) {
-            exit(1);
+        instances_attrib_pointers(0);
+    }
+
+    {
+        glGenBuffers(2, sr->cache.vbos);
+        for (size_t i = 0; i < 2; ++i) {
+            glBindBuffer(GL_ARRAY_BUFFER, sr->cache.vbos[i]);
+            glBufferData(GL_ARRAY_BUFFER, SIMPLE_CACHE_SLOTS*sizeof(sr->cache.instances), NULL, GL_DYNAMIC_DRAW);
         }
-        glDeleteShader(shaders[1]);
     }
-    glDeleteShader(shaders[0]);
+
+    glBindVertexArray(sr->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, sr->verticies_stream.vbo);
+
+    if (!load_program(sr, vert_shader_file_path, &sr->program)) {
+        exit(1);
+    }
+    if (!load_program(sr, instance_vert_shader_file_path, &sr->instances_program)) {
+        exit(1);
+    }
 }
 
 void simple_renderer_reload_shaders(Simple_Renderer *sr)
 {
-    GLuint programs[COUNT_SIMPLE_SHADERS];
-    GLuint shaders[2] = {0};
+    Simple_Program program;
+    Simple_Program instances_program;
 
-    bool ok = true;
-
-    if (!compile_shader_file(vert_shader_file_path, GL_VERTEX_SHADER, &shaders[0])) {
-        ok = false;
+    if (!load_program(sr, vert_shader_file_path, &program)) return;
+    if (!load_program(sr, instance_vert_shader_file_path, &instances_program)) {
+        glDeleteProgram(program.id);
+        return;
     }
 
-    for (int i = 0; i < COUNT_SIMPLE_SHADERS; ++i) {
-        if (!compile_shader_file(frag_shader_file_paths[i], GL_FRAGMENT_SHADER, &shaders[1])) {
-            ok = false;
-        }
-        programs[i] = glCreateProgram();
-        attach_shaders_to_program(shaders, sizeof(shaders) / sizeof(shaders[0]), programs[i]);
-        if (!link_program(programs[i], __FILE__, __LINE__)) {
-            ok = false;
-        }
-        glDeleteShader(shaders[1]);
-    }
-    glDeleteShader(shaders[0]);
+    glDeleteProgram(sr->program.id);
+    sr->program = program;
+    glDeleteProgram(sr->instances_program.id);
+    sr->instances_program = instances_program;
+    printf("Reloaded shaders successfully!\n");
+}
 
-    if (ok) {
-        for (int i = 0; i < COUNT_SIMPLE_SHADERS; ++i) {
-            glDeleteProgram(sr->programs[i]);
-            sr->programs[i] = programs[i];
-        }
-        printf("Reloaded shaders successfully!\n");
-    } else {
-        for (int i = 0; i < COUNT_SIMPLE_SHADERS; ++i) {
-            glDeleteProgram(programs[i]);
-        }
-    }
+static float clamp01(float x)
+{
+    if (x < 0.0f) return 0.0f;
+    if (x > 1.0f) return 1.0f;
+    return x;
 }
 
-// TODO: Don't render triples of verticies that form a triangle that is completely outside of the screen
-//
-// Ideas on how to check if a triangle is outside of the screen:
-// 1. Apply camera transformations to the triangle.
-// 2. Form an axis-aligned boundary box (AABB) of the triangle.
-// 3. Check if the Triangle AABB does not intersect the Screen AABB.
-//
-// This might not be what we want at the end of the day, though. Because in case of a lot of triangles we
-// end up iterating each of them at least once and doing camera trasformations on the CPU (which is
-// something we do on GPU already).
-//
-// It would be probably better if such culling occurred on a higher level of abstractions. For example
-// in the Editor. For instance, if the Editor noticed that the line it is currently rendering is
-// below the screen, it should stop rendering the rest of the text, thus never calling
-// simple_renderer_vertex() for a potentially large amount of verticies in the first place.
+// NOTE: the renderer does not cull anything. The triangles outside of the screen are expected to be
+// culled on a higher level of abstraction, like the Editor skipping the lines that are not visible.
 void simple_renderer_vertex(Simple_Renderer *sr, Vec2f p, Vec4f c, Vec2f uv)
 {
-#if 0
-    // TODO: flush the renderer on vertex buffer overflow instead firing the assert
-    if (sr->verticies_count >= SIMPLE_VERTICIES_CAP) simple_renderer_flush(sr);
-#else
-    // NOTE: it is better to just crash the app in this case until the culling described
-    // above is sorted out.
-    assert(sr->verticies_count < SIMPLE_VERTICIES_CAP);
-#endif
+    // NOTE: SIMPLE_VERTICIES_CAP is divisible by 3, so the segment is always flushed between the
+    // triangles, never in the middle of one.
+    if (sr->verticies_count >= SIMPLE_VERTICIES_CAP || sr->instances_count > 0) simple_renderer_flush(sr);
     Simple_Vertex *last = &sr->verticies[sr->verticies_count];
     last->position = p;
-    last->color    = c;
-    last->uv       = uv;
+    last->color[0] = (uint8_t) (clamp01(c.x)*255.0f + 0.5f);
+    last->color[1] = (uint8_t) (clamp01(c.y)*255.0f + 0.5f);
+    last->color[2] = (uint8_t) (clamp01(c.z)*255.0f + 0.5f);
+    last->color[3] = (uint8_t) (clamp01(c.w)*255.0f + 0.5f);
+    last->uv[0]    = (uint16_t) (clamp01(uv.x)*65535.0f + 0.5f);
+    last->uv[1]    = (uint16_t) (clamp01(uv.y)*65535.0f + 0.5f);
     sr->verticies_count += 1;
 }
 
@@ -291,43 +435,321 @@ void simple_renderer_image_rect(Simple_Renderer *sr, Vec2f p, Vec2f s, Vec2f uvp
         uvp, vec2f_add(uvp, vec2f(uvs.x, 0)), vec2f_add(uvp, vec2f(0, uvs.y)), vec2f_add(uvp, uvs));
 }
 
+static Simple_Instance *simple_renderer_instance(Simple_Renderer *sr, Vec2f p, Vec4f c, Simple_Shader shader, Simple_Instance_Kind kind)
+{
+    Simple_Instance *last = NULL;
+    if (sr->cache.recording && sr->cache.instances_count < SIMPLE_CACHE_SLOT_CAP) {
+        last = &sr->cache.instances[sr->cache.instances_count++];
+    } else {
+        if (sr->cache.recording) sr->cache.overflowed = true;
+        if (sr->instances_count >= SIMPLE_INSTANCES_CAP || sr->verticies_count > 0) simple_renderer_flush(sr);
+        last = &sr->instances[sr->instances_count++];
+    }
+    last->position = p;
+    last->size     = vec2fs(0);
+    last->color[0] = (uint8_t) (clamp01(c.x)*255.0f + 0.5f);
+    last->color[1] = (uint8_t) (clamp01(c.y)*255.0f + 0.5f);
+    last->color[2] = (uint8_t) (clamp01(c.z)*255.0f + 0.5f);
+    last->color[3] = (uint8_t) (clamp01(c.w)*255.0f + 0.5f);
+    last->glyph    = 0;
+    last->shader   = (uint8_t) shader;
+    last->kind     = (uint8_t) kind;
+    return last;
+}
+
+// NOTE: the rectangle is always filled with the color regardless of the current shader
 void simple_renderer_solid_rect(Simple_Renderer *sr, Vec2f p, Vec2f s, Vec4f c)
 {
-    Vec2f uv = vec2fs(0);
-    simple_renderer_quad(
-        sr,
-        p, vec2f_add(p, vec2f(s.x, 0)), vec2f_add(p, vec2f(0, s.y)), vec2f_add(p, s),
-        c, c, c, c,
-        uv, uv, uv, uv);
+    Simple_Instance *rect = simple_renderer_instance(sr, p, c, SHADER_FOR_COLOR, SIMPLE_INSTANCE_RECT);
+    rect->size = s;
+}
+
+void simple_renderer_glyph(Simple_Renderer *sr, Vec2f p, uint16_t glyph, Vec4f c)
+{
+    Simple_Instance *instance = simple_renderer_instance(sr, p, c, sr->current_shader, SIMPLE_INSTANCE_GLYPH);
+    instance->glyph = glyph;
 }
 
 void simple_renderer_sync(Simple_Renderer *sr)
 {
-    glBufferSubData(GL_ARRAY_BUFFER,
-                    0,
-                    sr->verticies_count * sizeof(Simple_Vertex),
-                    sr->verticies);
+    simple_stream_upload(&sr->verticies_stream, sr->verticies, sr->verticies_count * sizeof(Simple_Vertex));
+    sr->stats.buffer_upload += 1;
 }
 
 void simple_renderer_draw(Simple_Renderer *sr)
 {
-    glDrawArrays(GL_TRIANGLES, 0, sr->verticies_count);
+    sr->stats.draw += 1;
+    glDrawArrays(GL_TRIANGLES, sr->verticies_stream.segment * SIMPLE_VERTICIES_CAP, sr->verticies_count);
+}
+
+// Binds the program and brings its uniforms up to date. Only what has actually changed is sent to GL.
+// The uniforms that are not used by the program (location -1) are never sent at all.
+static void simple_renderer_use_program(Simple_Renderer *sr, Simple_Program *program)
+{
+    if (sr->bound_program != program->id) {
+        glUseProgram(program->id);
+        sr->bound_program = program->id;
+        sr->stats.use_program += 1;
+    }
+
+    GLint location = program->uniforms[UNIFORM_SLOT_RESOLUTION];
+    if (location >= 0 && (!program->uploaded || program->resolution.x != sr->resolution.x || program->resolution.y != sr->resolution.y)) {
+        glUniform2f(location, sr->resolution.x, sr->resolution.y);
+        sr->stats.uniform += 1;
+    }
+    location = program->uniforms[UNIFORM_SLOT_TIME];
+    if (location >= 0 && (!program->uploaded || program->time != sr->time)) {
+        glUniform1f(location, sr->time);
+        sr->stats.uniform += 1;
+    }
+    location = program->uniforms[UNIFORM_SLOT_CAMERA_POS];
+    if (location >= 0 && (!program->uploaded || program->camera_pos.x != sr->camera_pos.x || program->camera_pos.y != sr->camera_pos.y)) {
+        glUniform2f(location, sr->camera_pos.x, sr->camera_pos.y);
+        sr->stats.uniform += 1;
+    }
+    location = program->uniforms[UNIFORM_SLOT_CAMERA_SCALE];
+    if (location >= 0 && (!program->uploaded || program->camera_scale != sr->camera_scale)) {
+        glUniform1f(location, sr->camera_scale);
+        sr->stats.uniform += 1;
+    }
+    location = program->uniforms[UNIFORM_SLOT_SHADER];
+    if (location >= 0 && (!program->uploaded || program->shader != sr->current_shader)) {
+        glUniform1ui(location, sr->current_shader);
+        sr->stats.uniform += 1;
+    }
+
+    program->uploaded = true;
+    program->resolution = sr->resolution;
+    program->time = sr->time;
+    program->camera_pos = sr->camera_pos;
+    program->camera_scale = sr->camera_scale;
+    program->shader = sr->current_shader;
 }
 
+// The instances carry their shader, so switching it is free for them. Only the pending verticies have to
+// be flushed, since they are drawn with the shader set for the whole draw call.
 void simple_renderer_set_shader(Simple_Renderer *sr, Simple_Shader shader)
 {
+    if (sr->verticies_count > 0 && sr->current_shader != shader) simple_renderer_flush(sr);
     sr->current_shader = shader;
-    glUseProgram(sr->programs[sr->current_shader]);
-    get_uniform_location(sr->programs[sr->current_shader], sr->uniforms);
-    glUniform2f(sr->uniforms[UNIFORM_SLOT_RESOLUTION], sr->resolution.x, sr->resolution.y);
-    glUniform1f(sr->uniforms[UNIFORM_SLOT_TIME], sr->time);
-    glUniform2f(sr->uniforms[UNIFORM_SLOT_CAMERA_POS], sr->camera_pos.x, sr->camera_pos.y);
-    glUniform1f(sr->uniforms[UNIFORM_SLOT_CAMERA_SCALE], sr->camera_scale);
+}
+
+static void simple_renderer_flush_instances(Simple_Renderer *sr)
+{
+    simple_renderer_use_program(sr, &sr->instances_program);
+    glBindVertexArray(sr->instances_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, sr->instances_stream.vbo);
+    size_t offset = simple_stream_upload(&sr->instances_stream, sr->instances, sr->instances_count * sizeof(Simple_Instance));
+    instances_attrib_pointers(offset);
+    sr->stats.buffer_upload += 1;
+    sr->stats.draw += 1;
+    // 2-3
+    // |\|
+    // 0-1
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, sr->instances_count);
+    sr->instances_count = 0;
+    simple_stream_next(&sr->instances_stream);
+
+    glBindVertexArray(sr->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, sr->verticies_stream.vbo);
 }
 
 void simple_renderer_flush(Simple_Renderer *sr)
 {
-    simple_renderer_sync(sr);
-    simple_renderer_draw(sr);
-    sr->verticies_count = 0;
+    if (sr->verticies_count > 0) {
+        simple_renderer_use_program(sr, &sr->program);
+        simple_renderer_sync(sr);
+        simple_renderer_draw(sr);
+        sr->verticies_count = 0;
+        simple_stream_next(&sr->verticies_stream);
+    }
+    if (sr->instances_count > 0) {
+        simple_renderer_flush_instances(sr);
+    }
+}
+
+bool simple_renderer_layer_begin(Simple_Renderer *sr, int width, int height)
+{
+    Simple_Layer *layer = &sr->layer;
+    if (layer->broken) return false;
+
+    simple_renderer_flush(sr);
+
+    if (layer->fbo == 0) {
+        glGenFramebuffers(1, &layer->fbo);
+        glGenTextures(1, &layer->texture);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, layer->fbo);
+    if (layer->width != width || layer->height != height) {
+        GLint texture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+        glBindTexture(GL_TEXTURE_2D, layer->texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer->texture, 0);
+        layer->width = width;
+        layer->height = height;
+        glBindTexture(GL_TEXTURE_2D, texture);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "WARNING: the layer framebuffer is not complete. Rendering without it.\n");
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glDeleteFramebuffers(1, &layer->fbo);
+            glDeleteTextures(1, &layer->texture);
+            layer->broken = true;
+            return false;
+        }
+    }
+
+    static const GLfloat transparent[4] = {0};
+    glClearBufferfv(GL_COLOR, 0, transparent);
+    // The color is premultiplied by alpha on the way into the layer, so it can be composited with
+    // (GL_ONE, GL_ONE_MINUS_SRC_ALPHA) later without darkening the edges of the glyphs
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    return true;
+}
+
+void simple_renderer_layer_end(Simple_Renderer *sr)
+{
+    simple_renderer_flush(sr);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void simple_renderer_layer_draw(Simple_Renderer *sr)
+{
+    assert(!sr->layer.broken && sr->layer.fbo != 0);
+    simple_renderer_flush(sr);
+
+    GLint texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glBindTexture(GL_TEXTURE_2D, sr->layer.texture);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    Simple_Shader shader = sr->current_shader;
+    simple_renderer_set_shader(sr, SHADER_FOR_IMAGE);
+    // The world rectangle the camera sees
+    Vec2f half = vec2f(sr->resolution.x/2/sr->camera_scale, sr->resolution.y/2/sr->camera_scale);
+    simple_renderer_image_rect(sr, vec2f_sub(sr->camera_pos, half), vec2f_mul(half, vec2fs(2)), vec2fs(0), vec2fs(1), vec4fs(1));
+    simple_renderer_flush(sr);
+    simple_renderer_set_shader(sr, shader);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+#define SIMPLE_CAMERA_SETTLED_PIXELS 0.5f
+#define SIMPLE_CAMERA_SETTLED_SCALE 0.001f
+
+bool simple_renderer_camera_settled(const Simple_Renderer *sr)
+{
+    // NOTE: the camera moves towards its target with the velocity of twice the remaining distance
+    float distance = sqrtf(sr->camera_vel.x*sr->camera_vel.x + sr->camera_vel.y*sr->camera_vel.y)/2.0f;
+    return distance*sr->camera_scale < SIMPLE_CAMERA_SETTLED_PIXELS &&
+           fabsf(sr->camera_scale_vel)/2.0f < SIMPLE_CAMERA_SETTLED_SCALE*sr->camera_scale;
+}
+
+// Waits until the GPU is done with the last draw from the current copy of the cache, so it can be
+// written to without the implicit synchronization of the driver
+static void simple_cache_acquire(Simple_Cache *cache)
+{
+    GLsync fence = cache->fences[cache->copy];
+    if (fence) {
+        // NOTE: the copy was last drawn from a frame ago, so this almost never actually waits
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, SIMPLE_STREAM_WAIT_TIMEOUT_NS) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        cache->fences[cache->copy] = NULL;
+    }
+}
+
+// Copies the slots [slot, slot + count) that were rewritten in the other copy into the current one,
+// wrapping around the end of the cache
+static void simple_cache_sync(Simple_Renderer *sr, size_t slot, size_t count)
+{
+    Simple_Cache *cache = &sr->cache;
+    bool *stale = cache->stale[cache->copy];
+    while (count > 0) {
+        if (!stale[slot]) {
+            slot = (slot + 1) % SIMPLE_CACHE_SLOTS;
+            count -= 1;
+            continue;
+        }
+        size_t run = 0;
+        while (run < count && slot + run < SIMPLE_CACHE_SLOTS && stale[slot + run]) stale[slot + run++] = false;
+        glBindBuffer(GL_COPY_READ_BUFFER, cache->vbos[1 - cache->copy]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, cache->vbos[cache->copy]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                            slot*sizeof(cache->instances), slot*sizeof(cache->instances),
+                            run*sizeof(cache->instances));
+        sr->stats.buffer_upload += 1;
+        slot = (slot + run) % SIMPLE_CACHE_SLOTS;
+        count -= run;
+    }
+}
+
+void simple_renderer_cache_begin(Simple_Renderer *sr, size_t slot)
+{
+    assert(!sr->cache.recording);
+    assert(slot < SIMPLE_CACHE_SLOTS);
+    sr->cache.recording = true;
+    sr->cache.slot = slot;
+    sr->cache.instances_count = 0;
+    sr->cache.overflowed = false;
+}
+
+bool simple_renderer_cache_end(Simple_Renderer *sr)
+{
+    assert(sr->cache.recording);
+    sr->cache.recording = false;
+
+    // The empty rectangles cover no pixels
+    for (size_t i = sr->cache.instances_count; i < SIMPLE_CACHE_SLOT_CAP; ++i) {
+        sr->cache.instances[i] = (Simple_Instance) {
+            .kind = SIMPLE_INSTANCE_RECT,
+        };
+    }
+
+    simple_cache_acquire(&sr->cache);
+    glBindBuffer(GL_ARRAY_BUFFER, sr->cache.vbos[sr->cache.copy]);
+    glBufferSubData(GL_ARRAY_BUFFER, sr->cache.slot*sizeof(sr->cache.instances), sizeof(sr->cache.instances), sr->cache.instances);
+    glBindBuffer(GL_ARRAY_BUFFER, sr->verticies_stream.vbo);
+    sr->stats.buffer_upload += 1;
+    sr->cache.stale[sr->cache.copy][sr->cache.slot] = false;
+    sr->cache.stale[1 - sr->cache.copy][sr->cache.slot] = true;
+
+    return !sr->cache.overflowed;
+}
+
+void simple_renderer_cache_draw(Simple_Renderer *sr, size_t slot, size_t count)
+{
+    assert(!sr->cache.recording);
+    assert(slot < SIMPLE_CACHE_SLOTS);
+    assert(count <= SIMPLE_CACHE_SLOTS);
+    if (count == 0) return;
+
+    simple_renderer_flush(sr);
+    simple_renderer_use_program(sr, &sr->instances_program);
+    glBindVertexArray(sr->instances_vao);
+    simple_cache_acquire(&sr->cache);
+    // Everything is copied before the first draw call, so nothing is written into the copy after the
+    // GPU started reading it
+    simple_cache_sync(sr, slot, count);
+    glBindBuffer(GL_ARRAY_BUFFER, sr->cache.vbos[sr->cache.copy]);
+    while (count > 0) {
+        size_t n = SIMPLE_CACHE_SLOTS - slot < count ? SIMPLE_CACHE_SLOTS - slot : count;
+        instances_attrib_pointers(slot*sizeof(sr->cache.instances));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, n*SIMPLE_CACHE_SLOT_CAP);
+        sr->stats.draw += 1;
+        slot = (slot + n) % SIMPLE_CACHE_SLOTS;
+        count -= n;
+    }
+    // The slots rewritten from now on go into the other copy while the GPU is drawing this one
+    sr->cache.fences[sr->cache.copy] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    sr->cache.copy = 1 - sr->cache.copy;
+    glBindVertexArray(sr->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, sr->verticies_stream.vbo);
 }
@@ -2,6 +2,8 @@
 #define SIMPLE_RENDERER_H_
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -16,6 +18,7 @@ typedef enum {
     UNIFORM_SLOT_RESOLUTION,
     UNIFORM_SLOT_CAMERA_POS,
     UNIFORM_SLOT_CAMERA_SCALE,
+    UNIFORM_SLOT_SHADER,
     COUNT_UNIFORM_SLOTS,
 } Uniform_Slot;
 
@@ -25,16 +28,64 @@ typedef enum {
     SIMPLE_VERTEX_ATTR_UV,
 } Simple_Vertex_Attr;
 
+typedef enum {
+    SIMPLE_INSTANCE_ATTR_POSITION = 0,
+    SIMPLE_INSTANCE_ATTR_SIZE,
+    SIMPLE_INSTANCE_ATTR_COLOR,
+    SIMPLE_INSTANCE_ATTR_GLYPH,
+    SIMPLE_INSTANCE_ATTR_SHADER,
+    SIMPLE_INSTANCE_ATTR_KIND,
+} Simple_Instance_Attr;
+
+// NOTE: the color and uv are stored as normalized integers, so the shaders still receive them as
+// vec4 and vec2 in [0, 1]. The position stays float since the world coordinates of the lines grow
+// with the size of the file.
 typedef struct {
     Vec2f position;
-    Vec4f color;
-    Vec2f uv;
+    uint8_t color[4];  // RGBA8
+    uint16_t uv[2];    // unorm16
 } Simple_Vertex;
 
-#define SIMPLE_VERTICIES_CAP (3*640*1000)
+static_assert(sizeof(Simple_Vertex) == 16, "Simple_Vertex is expected to be tightly packed");
+
+typedef enum {
+    SIMPLE_INSTANCE_GLYPH = 0,
+    SIMPLE_INSTANCE_RECT,
+} Simple_Instance_Kind;
+
+// A glyph or a rectangle drawn as an instance of a quad. The vertex shader expands the glyphs using
+// their metrics looked up in the texture bound to SIMPLE_GLYPH_METRICS_TEXTURE_UNIT and the rectangles
+// using their size. Every instance carries the shader it is drawn with, so the whole frame is a single
+// instanced draw call no matter how many times the shader is switched. The instances are drawn in the
+// order they were pushed.
+typedef struct {
+    Vec2f position; // the pen position on the baseline for the glyphs, the corner for the rectangles
+    Vec2f size;     // the rectangles only
+    uint8_t color[4];
+    uint16_t glyph; // the glyphs only
+    uint8_t shader; // Simple_Shader
+    uint8_t kind;   // Simple_Instance_Kind
+} Simple_Instance;
+
+static_assert(sizeof(Simple_Instance) == 24, "Simple_Instance is expected to be tightly packed");
+
+// The texture is expected to be FREE_GLYPH_SLOTS x 2 of RGBA32F:
+// row 0 is (bitmap_left, bitmap_top, bitmap_width, bitmap_rows) in pixels,
+// row 1 is (u0, u1, v0, v1) of the glyph in the atlas.
+#define SIMPLE_GLYPH_METRICS_TEXTURE_UNIT 1
+
+// The geometry is streamed through a ring of SIMPLE_SEGMENTS_COUNT segments of the vertex buffer.
+// Once the current segment is full it is flushed and the next one is filled, so the frame can have any
+// amount of geometry while the memory stays bounded. Cycling through several segments lets the GPU
+// draw from the previous ones while the next one is being uploaded.
+#define SIMPLE_VERTICIES_CAP (3*4*1024)
+#define SIMPLE_INSTANCES_CAP (16*1024)
+#define SIMPLE_SEGMENTS_COUNT 4
 
 static_assert(SIMPLE_VERTICIES_CAP%3 == 0, "Simple renderer vertex capacity must be divisible by 3. We are rendring triangles after all.");
 
+// NOTE: all of them are branches of the same fragment shader selected by the shader of the vertex or
+// the instance. The values must match the ones defined in shaders/simple.frag.
 typedef enum {
     SHADER_FOR_COLOR = 0,
     SHADER_FOR_IMAGE,
@@ -44,12 +95,95 @@ typedef enum {
 } Simple_Shader;
 
 typedef struct {
-    GLuint vao;
+    GLuint id;
+    GLint uniforms[COUNT_UNIFORM_SLOTS]; // resolved once when the program is linked
+
+    // The values that were last uploaded to the uniforms of the program. GL keeps the uniforms per
+    // program, so they are uploaded again only if they have changed since.
+    bool uploaded;
+    float time;
+    Vec2f resolution;
+    Vec2f camera_pos;
+    float camera_scale;
+    Simple_Shader shader;
+} Simple_Program;
+
+// The amount of GL calls made by the renderer, broken down by kind
+typedef struct {
+    size_t use_program;
+    size_t get_uniform_location;
+    size_t uniform;
+    size_t buffer_upload;
+    size_t draw;
+} Simple_Renderer_Stats;
+
+// Ring of SIMPLE_SEGMENTS_COUNT segments within a single buffer. Every segment is fenced after it is
+// drawn from and is not written to again until the GPU is done with it, so the uploads never wait for
+// the draw calls that are still in flight.
+typedef struct {
     GLuint vbo;
-    GLuint programs[COUNT_SIMPLE_SHADERS];
-    Simple_Shader current_shader;
+    size_t segment_size; // in bytes
+    size_t segment;
+    // The whole buffer persistently mapped when GL_ARB_buffer_storage is available. Otherwise NULL and
+    // the buffer is orphaned every time the ring wraps around.
+    void *mapped;
+    GLsync fences[SIMPLE_SEGMENTS_COUNT];
+} Simple_Stream;
+
+// Instances that stay resident in GPU memory between the frames, so the geometry that has not changed
+// is neither regenerated nor uploaded again. The buffer is split into SIMPLE_CACHE_SLOTS slots of
+// SIMPLE_CACHE_SLOT_CAP instances each. The unused tail of every slot is filled with degenerate
+// instances, so any run of adjacent slots can be drawn with a single instanced draw call. What the
+// slots contain and when they are stale is up to the user of the cache.
+//
+// The buffer is double buffered. The slots are written into the copy that is going to be drawn next,
+// while the GPU may still be reading the other one, so refilling a slot never waits for the draw calls
+// in flight. The slots written into one copy are copied over into the other one right before it is
+// drawn.
+#define SIMPLE_CACHE_SLOTS 256
+#define SIMPLE_CACHE_SLOT_CAP 256
+
+typedef struct {
+    GLuint vbos[2];
+    GLsync fences[2]; // the last draw from the copy
+    size_t copy;      // the copy that is written to and drawn from
+    bool stale[2][SIMPLE_CACHE_SLOTS]; // the slot has been rewritten in the other copy since
+    bool recording;
+    bool overflowed;
+    size_t slot;
+    Simple_Instance instances[SIMPLE_CACHE_SLOT_CAP];
+    size_t instances_count;
+} Simple_Cache;
+
+// Offscreen texture of the size of the window that the stuff which rarely changes is rendered into
+// once and then composited onto the screen every frame. The layer is transparent, its colors are
+// premultiplied by alpha, so it can be composited over anything.
+typedef struct {
+    GLuint fbo;
+    GLuint texture;
+    int width;
+    int height;
+    bool broken; // the framebuffer is not supported, the layer is not used at all
+} Simple_Layer;
 
-    GLint uniforms[COUNT_UNIFORM_SLOTS];
+typedef struct {
+    GLuint vao;
+    Simple_Stream verticies_stream;
+    Simple_Program program;
+    Simple_Shader current_shader;
+    GLuint bound_program;
+
+    GLuint instances_vao;
+    Simple_Stream instances_stream;
+    // Same fragment shader as program but with the vertex shader that expands the instances
+    Simple_Program instances_program;
+    Simple_Instance instances[SIMPLE_INSTANCES_CAP];
+    size_t instances_count;
+    Simple_Cache cache;
+    Simple_Layer layer;
+
+    // NOTE: the verticies and the instances are never pending at the same time. Pushing one of them
+    // flushes the other, so everything is drawn in the order it was pushed.
     Simple_Vertex verticies[SIMPLE_VERTICIES_CAP];
     size_t verticies_count;
 
@@ -60,6 +194,8 @@ typedef struct {
     float camera_scale;
     float camera_scale_vel;
     Vec2f camera_vel;
+
+    Simple_Renderer_Stats stats;
 } Simple_Renderer;
 
 void simple_renderer_init(Simple_Renderer *sr);
@@ -79,7 +215,26 @@ void simple_renderer_quad(Simple_Renderer *sr,
                           Vec2f uv0, Vec2f uv1, Vec2f uv2, Vec2f uv3);
 void simple_renderer_solid_rect(Simple_Renderer *sr, Vec2f p, Vec2f s, Vec4f c);
 void simple_renderer_image_rect(Simple_Renderer *sr, Vec2f p, Vec2f s, Vec2f uvp, Vec2f uvs, Vec4f c);
+void simple_renderer_glyph(Simple_Renderer *sr, Vec2f p, uint16_t glyph, Vec4f c);
 void simple_renderer_flush(Simple_Renderer *sr);
+// Redirects the rendering into the cleared layer. Returns false if the layer is not available, in which
+// case the rendering stays on the screen.
+bool simple_renderer_layer_begin(Simple_Renderer *sr, int width, int height);
+void simple_renderer_layer_end(Simple_Renderer *sr);
+// Draws the layer over the whole screen after everything that was pushed before
+void simple_renderer_layer_draw(Simple_Renderer *sr);
+
+// Whether the camera has come within a fraction of a pixel of where it is heading
+bool simple_renderer_camera_settled(const Simple_Renderer *sr);
+
+// The instances pushed between begin and end are recorded into the slot of the cache instead of being
+// streamed. The ones that do not fit into the slot are streamed as usual, in which case end returns
+// false since the slot alone does not reproduce the recorded geometry.
+void simple_renderer_cache_begin(Simple_Renderer *sr, size_t slot);
+bool simple_renderer_cache_end(Simple_Renderer *sr);
+// Draws the slots [slot, slot + count) wrapping around the end of the cache, after everything that was
+// pushed before.
+void simple_renderer_cache_draw(Simple_Renderer *sr, size_t slot, size_t count);
 void simple_renderer_sync(Simple_Renderer *sr);
 void simple_renderer_draw(Simple_Renderer *sr);
 
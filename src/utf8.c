@@ -0,0 +1,126 @@
+#include <assert.h>
+
+// NOTE: build.sh does not pass -mavx2, so the AVX2 path is picked at run time like in line_index.c
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define UTF8_AVX2
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define UTF8_AVX2
+#define UTF8_AVX2_DISPATCH
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define UTF8_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "./utf8.h"
+
+#if defined(UTF8_AVX2) || defined(UTF8_SSE2)
+static uint32_t utf8_count_trailing_zeros(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+#endif
+
+// NOTE: movemask collects the top bits of the bytes which are set exactly for the non-ASCII ones
+
+#ifdef UTF8_AVX2
+// Checks the text 32 bytes at a time. Returns true if a non-ASCII byte is found at *len, otherwise
+// *len is how much of the text is checked.
+#ifdef UTF8_AVX2_DISPATCH
+__attribute__((target("avx2")))
+#endif
+static bool utf8_ascii_prefix_avx2(const char *text, size_t text_len, size_t *len)
+{
+    size_t i = 0;
+    for (; i + 32 <= text_len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (text + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(bytes);
+        if (mask != 0) {
+            *len = i + utf8_count_trailing_zeros(mask);
+            return true;
+        }
+    }
+    *len = i;
+    return false;
+}
+
+static bool utf8_avx2_supported(void)
+{
+#ifdef UTF8_AVX2_DISPATCH
+    return __builtin_cpu_supports("avx2");
+#else
+    return true;
+#endif
+}
+#endif
+
+size_t utf8_ascii_prefix(const char *text, size_t text_len)
+{
+    size_t i = 0;
+#ifdef UTF8_AVX2
+    if (utf8_avx2_supported() && utf8_ascii_prefix_avx2(text, text_len, &i)) return i;
+#endif
+#ifdef UTF8_SSE2
+    for (; i + 16 <= text_len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (text + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(bytes);
+        if (mask != 0) return i + utf8_count_trailing_zeros(mask);
+    }
+#endif
+    for (; i < text_len; ++i) {
+        if ((unsigned char) text[i] >= 0x80) return i;
+    }
+    return text_len;
+}
+
+uint32_t utf8_decode(const char *text, size_t text_len, size_t *len)
+{
+    const unsigned char *s = (const unsigned char *) text;
+    assert(text_len > 0);
+    *len = 1;
+    if (s[0] < 0x80) return s[0];
+
+    size_t n;
+    uint32_t codepoint;
+    if ((s[0] & 0xE0) == 0xC0) {
+        n = 2;
+        codepoint = s[0] & 0x1F;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        n = 3;
+        codepoint = s[0] & 0x0F;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        n = 4;
+        codepoint = s[0] & 0x07;
+    } else {
+        return UTF8_REPLACEMENT;
+    }
+    if (n > text_len) return UTF8_REPLACEMENT;
+    for (size_t i = 1; i < n; ++i) {
+        if ((s[i] & 0xC0) != 0x80) return UTF8_REPLACEMENT;
+        codepoint = (codepoint << 6) | (s[i] & 0x3F);
+    }
+
+    static const uint32_t min_codepoint[5] = {0, 0, 0x80, 0x800, 0x10000};
+    if (codepoint < min_codepoint[n] || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+        return UTF8_REPLACEMENT;
+    }
+    *len = n;
+    return codepoint;
+}
+
+bool utf8_is_continuation(char byte)
+{
+    return ((unsigned char) byte & 0xC0) == 0x80;
+}
@@ -0,0 +1,20 @@
+#ifndef UTF8_H_
+#define UTF8_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Malformed sequences, overlong encodings and surrogates are decoded into this codepoint a single
+// byte at a time, so decoding always makes progress and never reads past the end of the text.
+#define UTF8_REPLACEMENT '?'
+
+// The length of the longest prefix of the text that is pure ASCII. Vectorized with AVX2 when the CPU
+// supports it, with SSE2 or scalar otherwise. ASCII bytes are codepoints on their own, so the callers
+// handle that run byte by byte and decode only what follows it.
+size_t utf8_ascii_prefix(const char *text, size_t text_len);
+// Decodes the first codepoint of the non-empty text. Its length in bytes is stored into len.
+uint32_t utf8_decode(const char *text, size_t text_len, size_t *len);
+bool utf8_is_continuation(char byte);
+
+#endif // UTF8_H_